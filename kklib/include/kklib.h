@@ -2,7 +2,7 @@
 #ifndef KKLIB_H
 #define KKLIB_H 
 
-#define KKLIB_BUILD        89       // modify on changes to trigger recompilation
+#define KKLIB_BUILD        103      // modify on changes to trigger recompilation
 #define KK_MULTI_THREADED   1       // set to 0 to be used single threaded only
 // #define KK_DEBUG_FULL       1    // set to enable full internal debug checks
 
@@ -115,7 +115,12 @@ static inline bool kk_refcount_is_unique_or_thread_shared(kk_refcount_t rc) {
 
 // Every heap block starts with a 64-bit header with a reference count, tag, and scan fields count.
 // If the scan_fsize == 0xFF, the full scan count is in the first field as a boxed int (which includes the scan field itself).
+// With compressed fields, blocks (including static ones) must still be 8-byte aligned (see `kk_ptr_encode`).
+#if KK_COMPRESS
+typedef struct kk_decl_align(8) kk_header_s {
+#else
 typedef struct kk_header_s {
+#endif
   uint8_t   scan_fsize;  // number of fields that should be scanned when releasing (`scan_fsize <= 0xFF`, if 0xFF, the full scan size is the first field)
   uint8_t   _field_idx;  // private: only used during stack-less freeing and marking (see `refcount.c`)
   uint16_t  tag;         // constructor tag
@@ -145,20 +150,20 @@ static inline void kk_header_init(kk_header_t* h, kk_ssize_t scan_fsize, kk_tag_
 // The least significant bit is clear for `kk_block_t*` pointers, while it is set for values.
 // See `box.h` for definitions.
 typedef struct kk_box_s {
-  uintptr_t box;
+  kk_uintb_t box;
 } kk_box_t;
  
 // An integer is either a small int (as: 4*i + 1) or a `kk_bigint_t*` pointer. Isomorphic with boxed values.
 // See `integer.h` for definitions.
 typedef struct kk_integer_s {
-  uintptr_t ibox;
+  kk_uintb_t ibox;
 } kk_integer_t;
 
 // A general datatype with constructors and singletons is either
 // an enumeration (with the lowest bit set as: 4*tag + 1) or a `kk_block_t*` pointer.
 // Isomorphic with boxed values. 
 typedef struct kk_datatype_s {
-  uintptr_t dbox;
+  kk_uintb_t dbox;
 } kk_datatype_t;
 
 
@@ -231,6 +236,34 @@ typedef struct kk_block_large_s {
 // A pointer to a block. Cannot be NULL.
 typedef kk_block_t* kk_ptr_t;
 
+// Encode a block pointer in a boxed value or datatype field.
+// With compressed fields (`KK_COMPRESS`) a pointer is stored as a 32-bit offset from `kk_heap_base`.
+// The offset is shifted by 2 (keeping the lowest bit clear for pointers) as blocks are 8-byte aligned,
+// which gives a span of 16 GiB. At startup, the heap is reserved right after the static data of the
+// program such that static blocks (like string literals) can be encoded as well (see `init.c`).
+#if KK_COMPRESS
+#define KK_BOX_PTR_SHIFT  (2)
+kk_decl_export uintptr_t kk_heap_base;
+
+static inline kk_uintb_t kk_ptr_encode(const kk_block_t* p) {
+  kk_assert_internal(((uintptr_t)p & 0x07) == 0 && (uintptr_t)p >= kk_heap_base);
+  kk_assert_internal((uintptr_t)p - kk_heap_base < (KK_UP(1) << (32 + KK_BOX_PTR_SHIFT)));
+  return (kk_uintb_t)(((uintptr_t)p - kk_heap_base) >> KK_BOX_PTR_SHIFT);
+}
+
+static inline kk_ptr_t kk_ptr_decode(kk_uintb_t b) {
+  return (kk_ptr_t)(kk_heap_base + ((uintptr_t)b << KK_BOX_PTR_SHIFT));
+}
+#else
+static inline kk_uintb_t kk_ptr_encode(const kk_block_t* p) {
+  return (kk_uintb_t)p;
+}
+
+static inline kk_ptr_t kk_ptr_decode(kk_uintb_t b) {
+  return (kk_ptr_t)b;
+}
+#endif
+
 
 static inline kk_decl_const kk_tag_t kk_block_tag(const kk_block_t* b) {
   return (kk_tag_t)(b->header.tag);
@@ -278,10 +311,10 @@ static inline void kk_block_field_set(kk_block_t* b, kk_ssize_t index, kk_box_t
   bf->fields[index] = v;
 }
 
-#if (KK_INTPTR_SIZE==8)
-#define KK_BLOCK_INVALID  KK_UP(0xDFDFDFDFDFDFDFDF)
+#if (KK_INTB_SIZE==8)
+#define KK_BLOCK_INVALID  KK_UB(0xDFDFDFDFDFDFDFDF)
 #else
-#define KK_BLOCK_INVALID  KK_UP(0xDFDFDFDF)
+#define KK_BLOCK_INVALID  KK_UB(0xDFDFDFDF)
 #endif
 
 static inline void kk_block_set_invalid(kk_block_t* b) {
@@ -401,6 +434,8 @@ typedef struct kk_context_s {
   kk_duration_t  timer_delta;      // applied timer delta (to ensure monotonicity)
   int64_t        time_freq;        // unix time frequency
   kk_duration_t  time_unix_prev;   // last requested unix time
+  int64_t        heap_soft_limit;  // soft heap limit of this context (0 for the process soft limit, -1 for none)
+  bool           heap_limit_signaled; // signaled of exceeding the soft heap limit (reset once the heap is below the limit)
 } kk_context_t;
 
 // Get the current (thread local) runtime context (should always equal the `_ctx` parameter)
@@ -410,6 +445,12 @@ kk_decl_export void          kk_free_context(void);
 kk_decl_export kk_context_t* kk_main_start(int argc, char** argv);
 kk_decl_export void          kk_main_end(kk_context_t* ctx);
 
+// Interactive evaluation: a long-lived host process (`src/replhost.c`) reads paths of shared objects
+// from its command channel, loads each, and calls its `kk_repl_entry`. After each evaluation
+// `KK_REPL_DONE` is written to its reply channel.
+typedef void (kk_repl_entry_fun_t)(kk_context_t* ctx);
+#define KK_REPL_DONE  "\x1B[kk-repl-done]"
+
 kk_decl_export void          kk_debugger_break(kk_context_t* ctx);
 
 // The current context is passed as a _ctx parameter in the generated code
@@ -441,6 +482,41 @@ static inline int32_t kk_marker_unique(kk_context_t* ctx) {
 kk_decl_export void kk_block_mark_shared( kk_block_t* b, kk_context_t* ctx );
 kk_decl_export void kk_box_mark_shared( kk_box_t b, kk_context_t* ctx );
 kk_decl_export void kk_box_mark_shared_recx(kk_box_t b, kk_context_t* ctx);
+kk_decl_export void kk_block_mark_immortal( kk_block_t* b, kk_context_t* ctx );
+kk_decl_export void kk_box_mark_immortal( kk_box_t b, kk_context_t* ctx );
+
+/*--------------------------------------------------------------------------------------
+  Allocator options
+  Options can be given in the environment (e.g. `KK_HEAP_LARGE_OS_PAGES=1`), on the
+  command line (e.g. `--kkheap-large-os-pages=1`), or set from C before calling `kk_main_start`.
+  They are applied at `kk_main_start` before the main context is allocated.
+  Options are ignored if kklib is not compiled with mimalloc.
+--------------------------------------------------------------------------------------*/
+
+typedef enum kk_heap_option_e {
+  KK_HEAP_OPTION_LARGE_OS_PAGES,      // use large (2MiB) OS pages for the heap
+  KK_HEAP_OPTION_RESERVE_HUGE_PAGES,  // reserve N huge (1GiB) OS pages at startup
+  KK_HEAP_OPTION_RESERVE,             // reserve an arena of N bytes at startup
+  KK_HEAP_OPTION_PURGE_DELAY,         // delay in milli-seconds before unused memory is returned to the OS (-1 is never)
+  KK_HEAP_OPTION_EAGER_COMMIT,        // eagerly commit heap segments (fewer page faults, higher commit)
+  KK_HEAP_OPTION_ARENA_ONLY,          // only allocate from reserved arenas (i.e. a hard limit on the heap size)
+  KK_HEAP_OPTION_SOFT_LIMIT,          // signal each context once when the heap grows beyond N bytes (see `std/os/heap`)
+  KK_HEAP_OPTION_HARD_LIMIT,          // fail fast when the heap grows beyond N bytes
+  KK_HEAP_OPTION_COUNT
+} kk_heap_option_t;
+
+kk_decl_export void kk_heap_option_set(kk_heap_option_t option, int64_t value);
+kk_decl_export bool kk_heap_option_get(kk_heap_option_t option, int64_t* value);  // false if not set
+
+// The heap size is sampled by the allocator on its slow path and checked against the hard limit.
+// Each context has its own soft limit (by default the `KK_HEAP_OPTION_SOFT_LIMIT`) and can check at a
+// safe point if the usage of its own heap exceeded it (which returns `true` only once each time it grows beyond it).
+kk_decl_export size_t  kk_heap_current_size(void);       // committed heap size in bytes (0 if unknown)
+kk_decl_export size_t  kk_heap_context_size(kk_context_t* ctx);  // bytes in use in the heap of a context (0 if unknown)
+kk_decl_export int64_t kk_heap_soft_limit_of(kk_context_t* ctx);  // 0 if there is no soft limit
+kk_decl_export void    kk_heap_set_soft_limit_of(int64_t limit, kk_context_t* ctx);
+kk_decl_export bool    kk_heap_soft_limit_exceeded(kk_context_t* ctx);
+
 
 /*--------------------------------------------------------------------------------------
   Allocation
@@ -804,12 +880,12 @@ static inline void kk_reuse_drop(kk_reuse_t r, kk_context_t* ctx) {
 
 // create a singleton
 static inline kk_decl_const kk_datatype_t kk_datatype_from_tag(kk_tag_t t) {
-  kk_datatype_t d = { (((kk_uintf_t)t)<<2 | 1) };
+  kk_datatype_t d = { (kk_uintb_t)(((kk_uintf_t)t)<<2 | 1) };
   return d;
 }
 
 static inline kk_decl_const kk_datatype_t kk_datatype_from_ptr(kk_ptr_t p) {
-  kk_datatype_t d = { (uintptr_t)p };
+  kk_datatype_t d = { kk_ptr_encode(p) };
   return d;
 }
 
@@ -827,7 +903,7 @@ static inline kk_decl_const  bool kk_datatype_is_singleton(kk_datatype_t d) {
 
 static inline kk_decl_pure kk_tag_t kk_datatype_tag(kk_datatype_t d) {
   if (kk_datatype_is_ptr(d)) {
-    return kk_block_tag((kk_ptr_t)d.dbox);
+    return kk_block_tag(kk_ptr_decode(d.dbox));
   }
   else {
     return (kk_tag_t)(((kk_uintf_t)d.dbox) >> 2);
@@ -836,7 +912,7 @@ static inline kk_decl_pure kk_tag_t kk_datatype_tag(kk_datatype_t d) {
 
 static inline kk_decl_pure bool kk_datatype_has_tag(kk_datatype_t d, kk_tag_t t) {
   if (kk_datatype_is_ptr(d)) {
-    return (kk_block_tag((kk_ptr_t)d.dbox) == t); 
+    return (kk_block_tag(kk_ptr_decode(d.dbox)) == t); 
   }
   else {
     return (d.dbox == kk_datatype_from_tag(t).dbox);  // todo: optimize if sizeof(kk_uintf_t) < sizeof(uintptr_t) ?
@@ -844,7 +920,7 @@ static inline kk_decl_pure bool kk_datatype_has_tag(kk_datatype_t d, kk_tag_t t)
 }
 
 static inline kk_decl_pure bool kk_datatype_has_ptr_tag(kk_datatype_t d, kk_tag_t t) {
-  return (kk_datatype_is_ptr(d) && kk_block_tag((kk_ptr_t)d.dbox) == t);
+  return (kk_datatype_is_ptr(d) && kk_block_tag(kk_ptr_decode(d.dbox)) == t);
 }
 
 static inline kk_decl_pure bool kk_datatype_has_singleton_tag(kk_datatype_t d, kk_tag_t t) {
@@ -854,7 +930,7 @@ static inline kk_decl_pure bool kk_datatype_has_singleton_tag(kk_datatype_t d, k
 
 static inline kk_decl_const kk_block_t* kk_datatype_as_ptr(kk_datatype_t d) {
   kk_assert_internal(kk_datatype_is_ptr(d));
-  return (kk_ptr_t)d.dbox;
+  return kk_ptr_decode(d.dbox);
 }
 
 
@@ -948,6 +1024,33 @@ static inline void kk_datatype_decref(kk_datatype_t d, kk_context_t* ctx) {
   static kk_struct_tp _static_##name = { { KK_HEADER_STATIC(0,KK_TAG_OPEN) }, &kk__static_string_empty._base }; \
   decl kk_struct_tp* name = &_static_##name
 
+// Initializers for constant top-level values that are emitted as static data by the compiler.
+// These are bit-identical to their (boxed) runtime representation so they can be used for both
+// unboxed and boxed fields.
+// (With compressed fields (`KK_COMPRESS`) pointers are only known at runtime and `kk_static_ptr` is not available.)
+#define kk_static_tag(tag)        { (kk_uintb_t)((((kk_uintf_t)(tag))<<2) | 1) }             // singleton (or boxed singleton)
+#define kk_static_smallint(i)     { (kk_uintb_t)((((kk_uintf_t)((kk_intf_t)(i)))<<2) | 1) }  // small integer (or boxed small integer)
+#define kk_static_char_box(c)     { (kk_uintb_t)((((kk_uintf_t)((kk_intf_t)(c)))<<1) | 1) }  // boxed character (as `kk_char_box`)
+#if !KK_COMPRESS
+#define kk_static_ptr(s)          { (kk_uintb_t)&(s)._base._block }                         // static constructor as a datatype or box
+#endif
+
+// Top-level values that need computation are initialized lazily on first use. The compiler defines
+// the value name as `kk_lazy_value` which reads the value once its `state` is done, and otherwise
+// calls its (noinline) initializer. The initializer computes the value only if `kk_lazy_value_enter`
+// returns `true` and then calls `kk_lazy_value_leave`; if another thread is computing the value
+// already, `kk_lazy_value_enter` waits until it is done and returns `false`.
+typedef enum kk_lazy_state_e {
+  KK_LAZY_UNINIT,
+  KK_LAZY_RUNNING,
+  KK_LAZY_DONE
+} kk_lazy_state_t;
+
+kk_decl_export bool kk_lazy_value_enter(_Atomic(int32_t)* state);
+kk_decl_export void kk_lazy_value_leave(_Atomic(int32_t)* state);
+
+#define kk_lazy_value(state,value,init)  (kk_likely(kk_atomic_load_acquire(&state) == KK_LAZY_DONE) ? (value) : init())
+
 
 /*----------------------------------------------------------------------
   Reference counting of pattern matches
@@ -1015,6 +1118,26 @@ kk_decl_export void kk_fatal_error(int err, const char* msg, ...);
 kk_decl_export void kk_warning_message(const char* msg, ...);
 kk_decl_export void kk_info_message(const char* msg, ...);
 
+// Runtime logging (see `thread.c`): records are written asynchronously by a background thread.
+typedef enum kk_log_level_e {
+  KK_LOG_FATAL,
+  KK_LOG_ERROR,
+  KK_LOG_WARNING,
+  KK_LOG_INFO,
+  KK_LOG_DEBUG,
+  KK_LOG_TRACE
+} kk_log_level_t;
+
+kk_decl_export bool kk_log_enabled(kk_log_level_t level);
+kk_decl_export void kk_log_set_level(kk_log_level_t level);
+kk_decl_export bool kk_log_set_file(const char* path);
+kk_decl_export void kk_log_message(kk_log_level_t level, const char* msg);
+kk_decl_export void kk_log_message_now(kk_log_level_t level, const char* msg);
+kk_decl_export void kk_log_line(kk_log_level_t level, const char* msg, size_t len);
+kk_decl_export void kk_log_line_now(kk_log_level_t level, const char* msg, size_t len);
+kk_decl_export void kk_log_event(kk_log_level_t level, const char* event, const char* fmt, ...);
+kk_decl_export void kk_log_flush(void);
+
 static inline void kk_unsupported_external(const char* msg) {
   kk_fatal_error(ENOSYS, "unsupported external: %s", msg);
 }
@@ -1117,7 +1240,7 @@ static inline kk_box_t kk_datatype_unJust(kk_datatype_t d, kk_context_t* ctx) {
 #define kk_function_alloc_as(tp,scan_fsize,ctx)    kk_block_alloc_as(tp,scan_fsize,KK_TAG_FUNCTION,ctx)
 #define kk_function_call(restp,argtps,f,args)      ((restp(*)argtps)(kk_cfun_ptr_unbox(f->fun)))args
 #define kk_define_static_function(name,cfun,ctx) \
-  static struct kk_function_s _static_##name = { { KK_HEADER_STATIC(0,KK_TAG_FUNCTION) }, { ~KK_UP(0) } }; /* must be box_null */ \
+  static struct kk_function_s _static_##name = { { KK_HEADER_STATIC(0,KK_TAG_FUNCTION) }, { ~KK_UB(0) } }; /* must be box_null */ \
   kk_function_t name = &_static_##name; \
   if (kk_box_eq(name->fun,kk_box_null)) { name->fun = kk_cfun_ptr_box((kk_cfun_ptr_t)&cfun,ctx); }  // initialize on demand so it can be boxed properly
 
@@ -1255,7 +1378,7 @@ static inline kk_decl_const kk_vector_t kk_vector_unbox(kk_box_t v, kk_context_t
 --------------------------------------------------------------------------------------*/
 typedef struct kk_ref_s {
   kk_block_t         _block;
-  _Atomic(uintptr_t) value;   // kk_box_t
+  _Atomic(kk_uintb_t) value;  // kk_box_t
 } *kk_ref_t;
 
 kk_decl_export kk_box_t  kk_ref_get_thread_shared(kk_ref_t r, kk_context_t* ctx);
@@ -23,6 +23,10 @@ On platforms like arm CHERI, we have 128-bit pointers and a box is always
 128-bits in that case, but for values we just use the bottom 64 bits as
 the arithmetic registers are still 64-bit (using `kk_intf_t`).
 
+With compressed fields (`KK_INTB_SIZE==4` on a 64-bit platform) a box is 32 bits
+(`kk_intb_t`) and a heap pointer is stored as a (shifted) offset from the heap
+base (see `kk_ptr_encode`); values then use 31 bits just as on a 32-bit platform.
+
 On 64-bit, using `x` for bytes, and `b` for bits, with `z` the least significant byte, we have:
 
   xxxx xxxz   z = bbbbbbb0  : 64-bit pointer p  (always aligned to (at least) 2 bytes!)
@@ -40,7 +44,7 @@ On 64-bit, We can encode half of the doubles as values by saving 1 bit; Possible
       [0,2.0) and [-inf,-2.0) would be heap allocated. 
 ----------------------------------------------------------------*/
 
-#if (KK_INTPTR_SIZE == 8)
+#if (KK_INTB_SIZE == 8)
 #define KK_BOX_DOUBLE64    (1)    // box doubles on 64-bit using strategy A1 by default
 // #define KK_BOX_DOUBLE64    (2)    // heap allocate negative doubles on 64-bit (strategy A2)
 // #define KK_BOX_DOUBLE64    (0)    // heap allocate doubles interpreted as int64_t (strategy A0)
@@ -66,11 +70,11 @@ static inline kk_box_t     kk_intf_box(kk_intf_t i);
 
 // Low level access
 static inline kk_box_t _kk_box_new_ptr(const kk_block_t* p) {
-  kk_box_t b = { (uintptr_t)p };
+  kk_box_t b = { kk_ptr_encode(p) };
   return b;
 }
 static inline kk_box_t _kk_box_new_value(kk_uintf_t u) {
-  kk_box_t b = { u };
+  kk_box_t b = { (kk_uintb_t)u };
   return b;
 }
 
@@ -78,7 +82,7 @@ static inline kk_uintf_t _kk_box_value(kk_box_t b) {
   return (kk_uintf_t)(b.box);
 }
 static inline kk_ptr_t _kk_box_ptr(kk_box_t b) {
-  return (kk_ptr_t)(b.box);
+  return kk_ptr_decode(b.box);
 }
 
 // query
@@ -95,10 +99,10 @@ static inline bool kk_box_eq(kk_box_t b1, kk_box_t b2) {
 }
 
 // We cannot store NULL as a pointer (`kk_ptr_t`); use `box_null` instead
-#define kk_box_null       (_kk_box_new_ptr((kk_ptr_t)(~KK_UP(0))))  // -1 value
+#define kk_box_null       (_kk_box_new_value(~KK_UF(0)))  // -1 value
 
 // null initializer
-#define kk_box_null_init  {~KK_UP(0)}
+#define kk_box_null_init  {~KK_UB(0)}
 
 
 static inline bool kk_box_is_null(kk_box_t b) {
@@ -169,7 +173,7 @@ kk_decl_export kk_box_t kk_intptr_box(intptr_t i, kk_context_t* ctx);
 kk_decl_export kk_box_t   kk_ssize_box(kk_ssize_t i, kk_context_t* ctx);
 kk_decl_export kk_ssize_t kk_ssize_unbox(kk_box_t b, kk_context_t* ctx);
 
-#if (KK_INTPTR_SIZE <= 8)
+#if (KK_INTB_SIZE <= 8)
 kk_decl_export int64_t  kk_int64_unbox(kk_box_t v, kk_context_t* ctx);
 kk_decl_export kk_box_t kk_int64_box(int64_t i, kk_context_t* ctx);
 #else
@@ -186,7 +190,7 @@ static inline kk_box_t kk_int64_box(int64_t i, kk_context_t* ctx) {
 }
 #endif
 
-#if (KK_INTPTR_SIZE<=4)
+#if (KK_INTB_SIZE<=4)
 kk_decl_export int32_t  kk_int32_unbox(kk_box_t v, kk_context_t* ctx);
 kk_decl_export kk_box_t kk_int32_box(int32_t i, kk_context_t* ctx);
 #else
@@ -203,7 +207,7 @@ static inline kk_box_t kk_int32_box(int32_t i, kk_context_t* ctx) {
 }
 #endif
 
-#if (KK_INTPTR_SIZE<=2) 
+#if (KK_INTB_SIZE<=2) 
 kk_decl_export int16_t  kk_int16_unbox(kk_box_t v, kk_context_t* ctx);
 kk_decl_export kk_box_t kk_int16_box(int16_t i, kk_context_t* ctx);
 #else
@@ -219,7 +223,7 @@ static inline kk_box_t kk_int16_box(int16_t i, kk_context_t* ctx) {
 }
 #endif
 
-#if (KK_INTPTR_SIZE == 8) && KK_BOX_DOUBLE64
+#if (KK_INTB_SIZE == 8) && KK_BOX_DOUBLE64
 kk_decl_export kk_box_t kk_double_box(double d, kk_context_t* ctx);
 kk_decl_export double   kk_double_unbox(kk_box_t b, kk_context_t* ctx);
 #else
@@ -233,7 +237,7 @@ static inline kk_box_t kk_double_box(double d, kk_context_t* ctx) {
 }
 #endif
 
-#if (KK_INTPTR_SIZE == 4)
+#if (KK_INTB_SIZE == 4)
 kk_decl_export float    kk_float_unbox(kk_box_t b, kk_context_t* ctx);
 kk_decl_export kk_box_t kk_float_box(float f, kk_context_t* ctx);
 #else
@@ -288,6 +292,12 @@ static inline kk_box_t kk_ptr_box_assert(kk_block_t* b, kk_tag_t tag) {
 #define kk_basetype_unbox_as(tp,b)             ((tp)kk_ptr_unbox(b))
 #define kk_basetype_box(b)                     (kk_ptr_box(&(b)->_block))
 
+// A heap field that holds a full pointer (a function, reference, or datatype without singletons).
+// With compressed fields (`KK_COMPRESS`) the compiler stores such field as a `kk_box_t` so that
+// every scanned field has the same width.
+#define kk_field_ptr_store(b)                  (kk_basetype_box(b))
+#define kk_field_ptr_load(tp,f)                (kk_basetype_unbox_as(tp,f))
+
 #define kk_constructor_unbox_as(tp,b,tag)      (kk_basetype_unbox_as_assert(tp,b,tag))
 #define kk_constructor_box(b)                  (kk_basetype_box(&(b)->_base))
 
@@ -61,10 +61,10 @@ typedef struct kk_bytes_raw_s {
 #define kk_define_bytes_literal(decl,name,len,init) \
   static struct { struct kk_bytes_s _base; kk_ssize_t length; uint8_t buf[len+1]; } _static_##name = \
     { { { KK_HEADER_STATIC(0,KK_TAG_BYTES) } }, len, init }; \
-  decl kk_bytes_t name = { &_static_##name._base._block }; \
+  decl kk_bytes_t name = { kk_ptr_encode(&_static_##name._base._block) }; \
   
 #define kk_define_bytes_literal_empty(decl,name) \
-  decl kk_bytes_t name = { (kk_block_t*)((uintptr_t)(5)) };
+  decl kk_bytes_t name = { KK_UB(5) };
 
 static inline kk_bytes_t kk_bytes_unbox(kk_box_t v) {
   return kk_datatype_unbox(v);  
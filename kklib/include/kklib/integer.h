@@ -189,11 +189,11 @@ static inline bool kk_is_bigint(kk_integer_t i) {
 
 static inline kk_ptr_t _kk_integer_ptr(kk_integer_t i) {
   kk_assert_internal(kk_is_bigint(i));
-  return (kk_ptr_t)(i.ibox);
+  return kk_ptr_decode(i.ibox);
 }
 
 static inline kk_integer_t _kk_new_integer(kk_intf_t i) {
-  kk_integer_t z = { (uintptr_t)i }; // todo: optimize in case sizeof(kk_intf_t) < sizeof(intptr_t) ?
+  kk_integer_t z = { (kk_uintb_t)i }; // todo: optimize in case sizeof(kk_intf_t) < sizeof(intptr_t) ?
   return z;
 }
 
@@ -345,8 +345,38 @@ typedef unsigned       kk_uintx_t;
 #endif
 #define KK_INTX_BITS   (8*KK_INTX_SIZE)
 
-// `sizeof(kk_intf_t)` is `min(sizeof(kk_intx_t),sizeof(size_t))`
-#if (KK_INTX_SIZE > KK_SIZE_SIZE)
+// We define `kk_intb_t` as the integer size of a boxed value or field. This is `intptr_t` by
+// default, but on 64-bit platforms we can build with `-DKK_INTB_SIZE=4` to use compressed 32-bit
+// fields where heap pointers are an offset from a reserved heap base (`KK_COMPRESS`, see `kklib.h`).
+#ifndef KK_INTB_SIZE
+#define KK_INTB_SIZE   KK_INTPTR_SIZE
+#endif
+#if (KK_INTB_SIZE == KK_INTPTR_SIZE)
+typedef intptr_t       kk_intb_t;
+typedef uintptr_t      kk_uintb_t;
+#define KK_UB(i)       KK_UP(i)
+#define KK_COMPRESS    0
+#elif (KK_INTB_SIZE == 4 && KK_INTPTR_SIZE == 8)
+typedef int32_t        kk_intb_t;
+typedef uint32_t       kk_uintb_t;
+#define KK_UB(i)       KK_U32(i)
+#define KK_COMPRESS    1
+#else
+#error "boxed values must be the size of a pointer, or 32 bits on a 64-bit platform (KK_INTB_SIZE)"
+#endif
+#define KK_INTB_BITS   (8*KK_INTB_SIZE)
+
+// `sizeof(kk_intf_t)` is `min(sizeof(kk_intx_t),sizeof(size_t),sizeof(kk_intb_t))`
+#if KK_COMPRESS
+typedef int32_t        kk_intf_t;
+typedef uint32_t       kk_uintf_t;
+#define KK_UF(i)       KK_U32(i)
+#define KK_IF(i)       KK_I32(i)
+#define KK_INTF_SIZE   4
+#define KK_INTF_MAX    INT32_MAX
+#define KK_INTF_MIN    INT32_MIN
+#define KK_UINTF_MAX   UINT32_MAX
+#elif (KK_INTX_SIZE > KK_SIZE_SIZE)
 typedef kk_ssize_t     kk_intf_t;
 typedef size_t         kk_uintf_t;
 #define KK_UF(i)       KK_UZ(i)
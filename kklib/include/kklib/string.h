@@ -116,13 +116,32 @@ static inline kk_string_t kk_string_empty(void) {
 }
 
 // Define string literals
-#define kk_define_string_literal(decl,name,len,chars) \
+#define kk_declare_string_literal(decl,name,len,chars) \
   static struct { struct kk_bytes_s _base; size_t length; char str[len+1]; } _static_##name = \
-    { { { KK_HEADER_STATIC(0,KK_TAG_STRING) } }, len, chars }; \
-  decl kk_string_t name = { { (uintptr_t)&_static_##name._base._block } };  
+    { { { KK_HEADER_STATIC(0,KK_TAG_STRING) } }, len, chars }; 
+
+#if !KK_COMPRESS
+#define kk_define_string_literal(decl,name,len,chars) \
+  kk_declare_string_literal(decl,name,len,chars) \
+  decl kk_string_t name = { { (kk_uintb_t)&_static_##name._base._block } };  
+#else
+// With compressed fields the pointer to the static string is encoded at runtime. At the top-level, 
+// the compiler uses `kk_define_string_literal_init` instead and calls `kk_init_string_literal` at 
+// module initialization.
+#define kk_define_string_literal(decl,name,len,chars) \
+  kk_declare_string_literal(decl,name,len,chars) \
+  decl kk_string_t name = { kk_datatype_from_ptr(&_static_##name._base._block) };  
+#endif
+
+#define kk_define_string_literal_init(decl,name,len,chars) \
+  kk_declare_string_literal(decl,name,len,chars) \
+  decl kk_string_t name = { { KK_UB(5) } };  /* empty until initialized */
+
+#define kk_init_string_literal(name) \
+  name.bytes = kk_datatype_from_ptr(&_static_##name._base._block)
 
 #define kk_define_string_literal_empty(decl,name) \
-  decl kk_string_t name = { { (kk_block_t*)((uintptr_t)(5)) } };
+  decl kk_string_t name = { { KK_UB(5) } };
 
 static inline kk_string_t kk_string_unbox(kk_box_t v) {
   return kk_unsafe_bytes_as_string( kk_bytes_unbox(v) );
@@ -348,6 +367,7 @@ kk_decl_export kk_string_t    kk_string_convert_from_qutf8(kk_bytes_t b, kk_cont
 
 kk_decl_export uint16_t*      kk_string_to_qutf16_borrow(kk_string_t str, kk_context_t* ctx);
 kk_decl_export const char*    kk_string_to_qutf8_borrow(kk_string_t str, bool* should_free, kk_context_t* ctx);
+kk_decl_export const char*    kk_string_to_qutf8n_borrow(kk_string_t str, kk_ssize_t* qlen, bool* should_free, kk_context_t* ctx);
 
 
 #define kk_with_string_as_qutf8_borrow(str,ustr,ctx) /* { action } */ \
@@ -43,7 +43,7 @@ kk_box_t kk_intptr_box(intptr_t i, kk_context_t* ctx) {
 }
 
 
-#if (KK_INTPTR_SIZE <= 8) 
+#if (KK_INTB_SIZE <= 8) 
 typedef struct kk_boxed_int64_s {
   kk_block_t  _block;
   int64_t     value;
@@ -76,7 +76,7 @@ kk_box_t kk_int64_box(int64_t i, kk_context_t* ctx) {
 #endif
 
 
-#if (KK_INTPTR_SIZE <= 4)
+#if (KK_INTB_SIZE <= 4)
 typedef struct kk_boxed_int32_s {
   kk_block_t  _block;
   int32_t  value;
@@ -109,7 +109,7 @@ kk_box_t kk_int32_box(int32_t i, kk_context_t* ctx) {
 }
 #endif
 
-#if (KK_INTPTR_SIZE <= 2)
+#if (KK_INTB_SIZE <= 2)
 typedef struct kk_boxed_int16_s {
   kk_block_t  _block;
   int16_t  value;
@@ -207,7 +207,7 @@ kk_box_t kk_cptr_box(void* p, kk_context_t* ctx) {
 
 void* kk_cptr_unbox(kk_box_t b) {
   if (kk_box_is_value(b)) {
-    return (void*)(_kk_box_value(b) ^ 1);  // clear lowest bit
+    return (void*)((uintptr_t)_kk_box_value(b) ^ 1);  // clear lowest bit
   }
   else {
     return kk_cptr_raw_unbox(b);
@@ -231,7 +231,7 @@ kk_box_t kk_cfun_ptr_boxx(kk_cfun_ptr_t f, kk_context_t* ctx) {
 
 kk_cfun_ptr_t kk_cfun_ptr_unbox(kk_box_t b) {  // never drop; only used from function call
   if (kk_likely(kk_box_is_value(b))) {
-    return (kk_cfun_ptr_t)(kk_uintf_unbox(b));
+    return (kk_cfun_ptr_t)((uintptr_t)kk_uintf_unbox(b));
   }
   else {
     kk_cfunptr_t fp = kk_basetype_unbox_as_assert(kk_cfunptr_t, b, KK_TAG_CFUNPTR);
@@ -265,7 +265,7 @@ kk_box_t kk_unbox_Just_block( kk_block_t* b, kk_context_t* ctx ) {
   Double boxing on 64-bit systems
 ----------------------------------------------------------------*/
 
-#if (KK_INTPTR_SIZE == 8) && KK_BOX_DOUBLE64
+#if (KK_INTB_SIZE == 8) && KK_BOX_DOUBLE64
 // Generic double allocation in the heap
 typedef struct kk_boxed_double_s {
   kk_block_t _block;
@@ -377,7 +377,7 @@ double kk_double_unbox(kk_box_t b, kk_context_t* ctx) {
   Float boxing on 32-bit systems
 ----------------------------------------------------------------*/
 
-#if (KK_INTPTR_SIZE == 4) 
+#if (KK_INTB_SIZE == 4) 
 // Generic float allocation in the heap
 typedef struct kk_boxed_float_s {
   kk_block_t _block;
@@ -401,7 +401,7 @@ kk_box_t kk_float_box(float f, kk_context_t* ctx) {
   kk_unused(ctx);
   uint32_t i = kk_bits_from_float(f);
   if ((int32_t)i >= 0) {  // positive?
-    kk_box_t b = { ((uintptr_t)i<<1)|1 };
+    kk_box_t b = { (kk_uintb_t)(((uintptr_t)i<<1)|1) };
     return b;
   }
   else {
@@ -415,7 +415,7 @@ float kk_float_unbox(kk_box_t b, kk_context_t* ctx) {
   float f;
   if (kk_box_is_value(b)) {
     // positive float
-    uint32_t u = kk_shrp(b.box, 1);
+    uint32_t u = (uint32_t)kk_shrp(b.box, 1);
     f = kk_bits_to_float(u);
   }
   else {
@@ -53,7 +53,7 @@ void kk_free_fun(void* p, kk_block_t* b, kk_context_t* ctx) {
 
 kk_string_t kk_get_host(kk_context_t* ctx) {
   kk_unused(ctx);
-  kk_define_string_literal(static, host, 5, "libc")
+  kk_define_string_literal(, host, 5, "libc")
   return kk_string_dup(host);
 }
 
@@ -77,23 +77,9 @@ static void _strlcat(char* dest, const char* src, size_t kk_dest_size) {
 }
 */
 
-typedef enum kk_log_level_e {
-  KK_LOG_FATAL,
-  KK_LOG_ERROR,
-  KK_LOG_WARNING,
-  KK_LOG_INFO,
-  KK_LOG_DEBUG,
-  KK_LOG_TRACE
-} kk_log_level_t;
-
-static void kk_log_message(kk_log_level_t level, const char* msg, kk_context_t* ctx) {
-  kk_unused(ctx); kk_unused(level);
-  fputs(msg,stderr); // TODO: use ctx->log
-}
-
 static void kk_log_message_fmt(kk_context_t* ctx, kk_log_level_t level, const char* fmt, va_list args) {
   char buf[512];
-  if (fmt==NULL) return;
+  if (fmt==NULL || !kk_log_enabled(level)) return;  // filter before formatting
   size_t prefix_len = 0;
   const char* prefix = NULL;
   if (level==KK_LOG_FATAL) prefix = "fatal: ";
@@ -107,7 +93,12 @@ static void kk_log_message_fmt(kk_context_t* ctx, kk_log_level_t level, const ch
     _strlcpy(buf, prefix, sizeof(buf));
   }
   vsnprintf(buf + prefix_len, sizeof(buf) - 1 - prefix_len, fmt, args);
-  kk_log_message(level,buf,ctx);
+  if (level==KK_LOG_FATAL || ctx==NULL) {
+    kk_log_message_now(level,buf);  // written before aborting (or before the runtime is initialized)
+  }
+  else {
+    kk_log_message(level,buf);
+  }
 }
 
 void kk_fatal_error(int err, const char* fmt, ...) {
@@ -151,6 +142,76 @@ bool kk_has_lzcnt = false;
 bool kk_has_tzcnt = false;
 #endif
 
+#if KK_COMPRESS
+/*--------------------------------------------------------------------------------------------------
+  Compressed heap: all heap blocks (and static blocks) must be within 16 GiB of `kk_heap_base`.
+  We reserve a region directly after the static data of the program image and let mimalloc
+  allocate only inside it. The base is put somewhat below the static data such that
+  static blocks encode as well (and such that offset 0 is never a valid block).
+--------------------------------------------------------------------------------------------------*/
+#if !defined(KK_MIMALLOC)
+#error "compressed pointers (KK_INTB_SIZE=4) require mimalloc (KK_MIMALLOC)"
+#endif
+#if !defined(WIN32)
+#include <sys/mman.h>
+#if !defined(MAP_FIXED_NOREPLACE) && defined(__linux__)
+#define MAP_FIXED_NOREPLACE  0x100000   // since Linux 4.17 (older kernels treat the address as a hint)
+#elif !defined(MAP_FIXED_NOREPLACE)
+#define MAP_FIXED_NOREPLACE  0
+#endif
+#endif
+
+uintptr_t kk_heap_base;
+
+#define KK_COMPRESS_SPAN       (KK_UP(1) << (32 + KK_BOX_PTR_SHIFT))   // 16 GiB addressable
+#define KK_COMPRESS_SLACK      (KK_UP(256) << 20)                       // 256 MiB below the static data
+#define KK_COMPRESS_HEAP_SIZE  (KK_UP(8) << 30)                         // 8 GiB reserved heap
+
+static char kk_compress_marker;   // lives in the static data of the image
+
+// reserve the heap at exactly `addr`, or return NULL if (part of) that range is in use
+static void* kk_compress_reserve_at(uintptr_t addr) {
+  #if defined(WIN32)
+  return VirtualAlloc((void*)addr, KK_COMPRESS_HEAP_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+  #else
+  void* p = mmap((void*)addr, KK_COMPRESS_HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  if ((uintptr_t)p != addr) {  // the address was only used as a hint
+    munmap(p, KK_COMPRESS_HEAP_SIZE);
+    return NULL;
+  }
+  return p;
+  #endif
+}
+
+static void kk_compress_heap_init(void) {
+  const uintptr_t align = (KK_UP(1) << 22);  // 4 MiB
+  uintptr_t marker = (uintptr_t)&kk_compress_marker;
+  kk_heap_base = (marker > KK_COMPRESS_SLACK ? (marker - KK_COMPRESS_SLACK) & ~(align - 1) : align);
+  const uintptr_t start = (marker + KK_COMPRESS_SLACK + align - 1) & ~(align - 1);
+  const uintptr_t last  = kk_heap_base + KK_COMPRESS_SPAN - KK_COMPRESS_HEAP_SIZE;
+  // try right after the static data first, and then at other aligned addresses within the span
+  void* region = NULL;
+  for (uintptr_t addr = start; region == NULL && addr <= last; addr += KK_COMPRESS_SLACK) {
+    region = kk_compress_reserve_at(addr);
+  }
+  if (region == NULL) {
+    kk_fatal_error(ENOMEM, "unable to reserve the compressed heap between %p and %p", (void*)start, (void*)(last + KK_COMPRESS_HEAP_SIZE));
+    return;
+  }
+  #if defined(WIN32)
+  const bool committed = false;  // mimalloc commits on demand
+  #else
+  const bool committed = true;   // pages are only backed on first touch
+  #endif
+  if (!mi_manage_os_memory(region, KK_COMPRESS_HEAP_SIZE, committed, false /* large */, true /* zero */, -1 /* numa node */)) {
+    kk_fatal_error(ENOMEM, "unable to use the reserved compressed heap");
+    return;
+  }
+  mi_option_set(mi_option_limit_os_alloc, 1);  // never allocate outside the reserved region
+}
+#endif
+
 static void kklib_init(void) {
   if (process_initialized) return;
   process_initialized = true;
@@ -158,6 +219,9 @@ static void kklib_init(void) {
   setlocale(LC_ALL, "C.utf8"); 
 #if defined(WIN32) && (defined(_CONSOLE) || defined(__MINGW32__))
   SetConsoleOutputCP(65001);   // set the console to utf-8 instead of OEM page
+#endif
+#if KK_COMPRESS
+  kk_compress_heap_init();
 #endif
   //todo: do we need to set the IEEE floating point flags?
   //fexcept_t fexn;
@@ -186,7 +250,7 @@ static kk_decl_thread kk_context_t* context;
 
 
 static struct { kk_block_t _block; kk_integer_t cfc; } kk_evv_empty_static = {
-  { KK_HEADER_STATIC(1,KK_TAG_EVV_VECTOR) }, { ((~KK_UP(0))^0x02) /*==-1 smallint*/}
+  { KK_HEADER_STATIC(1,KK_TAG_EVV_VECTOR) }, { (kk_uintb_t)((~KK_UB(0))^0x02) /*==-1 smallint*/}
 };
 kk_ptr_t kk_evv_empty_singleton = &kk_evv_empty_static._block;
 
@@ -229,24 +293,280 @@ void kk_free_context(void) {
   }
 }
 
+/*--------------------------------------------------------------------------------------------------
+  Allocator options
+--------------------------------------------------------------------------------------------------*/
+
+typedef struct kk_heap_option_desc_s {
+  const char* name;     // name as used on the command line: `--kkheap-<name>=<value>`
+  const char* env;      // environment variable name
+  bool        is_size;  // allow `k`, `m`, and `g` suffixes
+  _Atomic(bool)    is_set;   // options can be read from the allocator callbacks on any thread
+  _Atomic(int64_t) value;
+} kk_heap_option_desc_t;
+
+static kk_heap_option_desc_t kk_heap_options[KK_HEAP_OPTION_COUNT] = {
+  { "large-os-pages",     "KK_HEAP_LARGE_OS_PAGES",     false, false, 0 },
+  { "reserve-huge-pages", "KK_HEAP_RESERVE_HUGE_PAGES", false, false, 0 },
+  { "reserve",            "KK_HEAP_RESERVE",            true,  false, 0 },
+  { "purge-delay",        "KK_HEAP_PURGE_DELAY",        false, false, 0 },
+  { "eager-commit",       "KK_HEAP_EAGER_COMMIT",       false, false, 0 },
+  { "arena-only",         "KK_HEAP_ARENA_ONLY",         false, false, 0 },
+  { "soft-limit",         "KK_HEAP_SOFT_LIMIT",         true,  false, 0 },
+  { "hard-limit",         "KK_HEAP_HARD_LIMIT",         true,  false, 0 }
+};
+
+static void kk_heap_option_desc_set(kk_heap_option_desc_t* desc, int64_t value) {
+  kk_atomic_store_relaxed(&desc->value, value);
+  kk_atomic_store_release(&desc->is_set, true);
+}
+
+kk_decl_export void kk_heap_option_set(kk_heap_option_t option, int64_t value) {
+  if (option < 0 || option >= KK_HEAP_OPTION_COUNT) return;
+  kk_heap_option_desc_set(&kk_heap_options[option], value);
+}
+
+kk_decl_export bool kk_heap_option_get(kk_heap_option_t option, int64_t* value) {
+  if (option < 0 || option >= KK_HEAP_OPTION_COUNT || !kk_atomic_load_acquire(&kk_heap_options[option].is_set)) return false;
+  if (value != NULL) *value = kk_atomic_load_relaxed(&kk_heap_options[option].value);
+  return true;
+}
+
+// parse an option value as a number, or a boolean like `on`, or a size like `4g`
+static bool kk_heap_option_parse(kk_heap_option_desc_t* desc, const char* s) {
+  int64_t value;
+  if (s == NULL || *s == 0 || strcmp(s, "on")==0 || strcmp(s, "true")==0) {
+    value = 1;
+  }
+  else if (strcmp(s, "off")==0 || strcmp(s, "false")==0) {
+    value = 0;
+  }
+  else {
+    char* end = NULL;
+    errno = 0;
+    const long long n = strtoll(s, &end, 10);
+    if (end == s || errno == ERANGE) return false;
+    value = (int64_t)n;
+    if (desc->is_size && *end != 0) {
+      const char c = (char)((*end >= 'A' && *end <= 'Z') ? (*end - 'A' + 'a') : *end);
+      int64_t unit;
+      if (c == 'k') unit = KK_I64(1) << 10;
+      else if (c == 'm') unit = KK_I64(1) << 20;
+      else if (c == 'g') unit = KK_I64(1) << 30;
+      else return false;
+      if (value > INT64_MAX / unit || value < INT64_MIN / unit) return false;  // overflow
+      value *= unit;
+      end++;
+      if (*end == 'b' || *end == 'B') end++;
+    }
+    if (*end != 0) return false;
+  }
+  kk_heap_option_desc_set(desc, value);
+  return true;
+}
+
+// warnings are issued before the main context exists
+static void kk_heap_option_warning(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  kk_log_message_fmt(NULL, KK_LOG_WARNING, fmt, args);
+  va_end(args);
+}
+
+// read heap options from the environment; command line options override these.
+static void kk_heap_options_from_env(void) {
+  for (int i = 0; i < KK_HEAP_OPTION_COUNT; i++) {
+    kk_heap_option_desc_t* desc = &kk_heap_options[i];
+    if (kk_atomic_load_relaxed(&desc->is_set)) continue;  // set explicitly from C
+    const char* s = getenv(desc->env);
+    if (s != NULL && !kk_heap_option_parse(desc, s)) {
+      kk_heap_option_warning("invalid value for environment variable %s: %s\n", desc->env, s);
+    }
+  }
+}
+
+// try to parse a `--kkheap-<name>[=<value>]` command line option
+static bool kk_heap_option_from_arg(const char* arg) {
+  static const char prefix[] = "--kkheap-";
+  const size_t prefix_len = sizeof(prefix) - 1;
+  if (strncmp(arg, prefix, prefix_len) != 0) return false;
+  const char* name = arg + prefix_len;
+  for (int i = 0; i < KK_HEAP_OPTION_COUNT; i++) {
+    kk_heap_option_desc_t* desc = &kk_heap_options[i];
+    const size_t len = strlen(desc->name);
+    if (strncmp(name, desc->name, len)==0 && (name[len]==0 || name[len]=='=')) {
+      const char* value = (name[len]=='=' ? name + len + 1 : NULL);
+      if (!kk_heap_option_parse(desc, value)) {
+        kk_heap_option_warning("invalid value for option %s\n", arg);
+      }
+      return true;
+    }
+  }
+  kk_heap_option_warning("unknown heap option: %s\n", arg);
+  return true;
+}
+
+/*--------------------------------------------------------------------------------------------------
+  Heap limits
+  The process heap size is sampled on the slow path of the allocator and if it exceeds the hard
+  limit we fail fast. Each context has its own soft limit which it checks against the usage of its
+  own heap at its safe points (see `kk_heap_soft_limit_exceeded` and `std/os/heap`): it is signaled
+  once each time its heap grows beyond its limit. Without mimalloc the heap size is unknown and the
+  limits are not enforced.
+--------------------------------------------------------------------------------------------------*/
+
+kk_decl_export size_t kk_heap_current_size(void) {
+#ifdef KK_MIMALLOC
+  size_t current_commit = 0;
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &current_commit, NULL, NULL);
+  return current_commit;
+#else
+  return 0;
+#endif
+}
+
+#ifdef KK_MIMALLOC
+static bool kk_heap_area_used(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  kk_unused(heap); kk_unused(block); kk_unused(block_size);
+  *((size_t*)arg) += area->used * area->block_size;
+  return true;
+}
+#endif
+
+// The bytes in use in the heap of a context; this visits the areas (pages) of the heap
+// but not the blocks, and is only used at safe points.
+kk_decl_export size_t kk_heap_context_size(kk_context_t* ctx) {
+#ifdef KK_MIMALLOC
+  size_t used = 0;
+  mi_heap_visit_blocks(ctx->heap, false, &kk_heap_area_used, &used);
+  return used;
+#else
+  kk_unused(ctx);
+  return 0;
+#endif
+}
+
+kk_decl_export int64_t kk_heap_soft_limit_of(kk_context_t* ctx) {
+  int64_t limit = ctx->heap_soft_limit;
+  if (limit == 0 && !kk_heap_option_get(KK_HEAP_OPTION_SOFT_LIMIT, &limit)) return 0;
+  return (limit < 0 ? 0 : limit);
+}
+
+// set the soft limit of a context (0 for no soft limit)
+kk_decl_export void kk_heap_set_soft_limit_of(int64_t limit, kk_context_t* ctx) {
+  ctx->heap_soft_limit = (limit <= 0 ? -1 : limit);
+  ctx->heap_limit_signaled = false;
+}
+
+kk_decl_export bool kk_heap_soft_limit_exceeded(kk_context_t* ctx) {
+  const int64_t limit = kk_heap_soft_limit_of(ctx);
+  if (limit <= 0) return false;
+  const size_t size = kk_heap_context_size(ctx);
+  if (size <= (uint64_t)limit) {
+    ctx->heap_limit_signaled = false;  // signal again once the heap grows beyond the limit
+    return false;
+  }
+  if (ctx->heap_limit_signaled) return false;
+  ctx->heap_limit_signaled = true;
+  return true;
+}
+
+#ifdef KK_MIMALLOC
+// called by mimalloc regularly on the allocation slow path
+static void kk_heap_limit_sample(bool force, unsigned long long heartbeat, void* arg) {
+  kk_unused(arg);
+  if (!force && (heartbeat % 16) != 0) return;
+  int64_t limit;
+  if (!kk_heap_option_get(KK_HEAP_OPTION_HARD_LIMIT, &limit) || limit <= 0) return;
+  const size_t size = kk_heap_current_size();
+  if (size > (uint64_t)limit) {
+    kk_fatal_error(ENOMEM, "heap size (%zu bytes) exceeds the hard limit (%lld bytes)\n", size, (long long)limit);
+  }
+}
+
+// fail fast when out of memory or on heap corruption, and log other allocator errors
+static void kk_heap_error(int err, void* arg) {
+  kk_unused(arg);
+  if (err == ENOMEM) {
+    kk_fatal_error(err, "out of memory (heap size: %zu bytes)\n", kk_heap_current_size());
+  }
+  else if (err == EFAULT) {
+    kk_fatal_error(err, "heap corruption detected (double free or invalid pointer)\n");
+  }
+  else {
+    kk_warning_message("allocator error: %s (error %d)\n", strerror(err), err);
+  }
+}
+
+// mimalloc options are a `long` (which is 32-bit on Windows)
+static long kk_heap_option_long(int64_t value) {
+  return (value > LONG_MAX ? LONG_MAX : (value < LONG_MIN ? LONG_MIN : (long)value));
+}
+#endif
+
+// apply the heap options to the allocator; called before the main context is allocated.
+static void kk_heap_options_apply(void) {
+#ifdef KK_MIMALLOC
+  int64_t value;
+  if (kk_heap_option_get(KK_HEAP_OPTION_LARGE_OS_PAGES, &value)) {
+    mi_option_set(mi_option_large_os_pages, kk_heap_option_long(value));
+  }
+  if (kk_heap_option_get(KK_HEAP_OPTION_EAGER_COMMIT, &value)) {
+    mi_option_set(mi_option_eager_commit, kk_heap_option_long(value));
+  }
+  if (kk_heap_option_get(KK_HEAP_OPTION_PURGE_DELAY, &value)) {
+    mi_option_set(mi_option_reset_delay, kk_heap_option_long(value));  // (renamed to `mi_option_purge_delay` in newer mimalloc versions)
+  }
+  #if KK_COMPRESS
+  // with compressed pointers all allocation must stay inside the reserved compressed heap
+  if (kk_heap_option_get(KK_HEAP_OPTION_RESERVE_HUGE_PAGES, NULL) || kk_heap_option_get(KK_HEAP_OPTION_RESERVE, NULL) ||
+      kk_heap_option_get(KK_HEAP_OPTION_ARENA_ONLY, NULL)) {
+    kk_heap_option_warning("the reserve, reserve-huge-pages, and arena-only heap options are ignored with compressed pointers\n");
+  }
+  #else
+  if (kk_heap_option_get(KK_HEAP_OPTION_RESERVE_HUGE_PAGES, &value) && value > 0 && (uint64_t)value <= SIZE_MAX / 1000) {
+    int err = mi_reserve_huge_os_pages_interleave((size_t)value, 0 /* all numa nodes */, (size_t)value * 500 /* timeout in ms */);
+    if (err != 0) kk_heap_option_warning("unable to reserve %lld huge OS pages (error %d)\n", (long long)value, err);
+  }
+  if (kk_heap_option_get(KK_HEAP_OPTION_RESERVE, &value) && value > 0 && (uint64_t)value <= SIZE_MAX) {
+    const bool allow_large = kk_heap_option_get(KK_HEAP_OPTION_LARGE_OS_PAGES, NULL);
+    int err = mi_reserve_os_memory((size_t)value, true /* commit */, allow_large);
+    if (err != 0) kk_heap_option_warning("unable to reserve a heap arena of %lld bytes (error %d)\n", (long long)value, err);
+  }
+  if (kk_heap_option_get(KK_HEAP_OPTION_ARENA_ONLY, &value)) {
+    mi_option_set(mi_option_limit_os_alloc, (value != 0 ? 1 : 0));
+  }
+  #endif
+  mi_register_deferred_free(&kk_heap_limit_sample, NULL);  // always register as the hard limit can be set later on (from C)
+  mi_register_error(&kk_heap_error, NULL);
+#endif
+}
+
+
 /*--------------------------------------------------------------------------------------------------
   Called from main
 --------------------------------------------------------------------------------------------------*/
 
 kk_decl_export kk_context_t* kk_main_start(int argc, char** argv) {
-  kk_context_t* ctx = kk_get_context();
+  kk_timer_t process_start = 0;
+  kk_ssize_t i = 0;
   // process kklib options
   if (argv != NULL && argc >= 1) {
-    kk_ssize_t i;
     for (i = 1; i < argc; i++) {   // argv[0] is the program name
       const char* arg = argv[i];
       if (strcmp(arg, "--kktime")==0) {
-        ctx->process_start = kk_timer_start();
+        process_start = kk_timer_start();
       }
-      else {
+      else if (!kk_heap_option_from_arg(arg)) {
         break;
       }
     }
+  }
+  kk_heap_options_from_env();
+  kk_heap_options_apply();
+  kk_context_t* ctx = kk_get_context();
+  ctx->process_start = process_start;
+  if (argv != NULL && argc >= 1) {
     i--;  // i == number of processed --kkxxx options
     if (i > 0) {
       argv[i] = argv[0]; // move the program name to the last processed --kkxxx option
@@ -267,11 +587,12 @@ kk_decl_export void  kk_main_end(kk_context_t* ctx) {
     size_t page_reclaim;
     size_t peak_commit;
     kk_process_info(&user_time, &sys_time, &peak_rss, &page_faults, &page_reclaim, &peak_commit);
-    kk_info_message("elapsed: %ld.%03lds, user: %ld.%03lds, sys: %ld.%03lds, rss: %lu%s\n", 
+    kk_info_message("elapsed: %ld.%03lds, user: %ld.%03lds, sys: %ld.%03lds, rss: %lu%s, page faults: %lu\n", 
                     (long)(wall_time/1000000), (long)((wall_time%1000000)/1000), 
                     user_time/1000, user_time%1000, sys_time/1000, sys_time%1000, 
                     (peak_rss > 10*1024*1024 ? peak_rss/(1024*1024) : peak_rss/1024),
-                    (peak_rss > 10*1024*1024 ? "mb" : "kb") );
+                    (peak_rss > 10*1024*1024 ? "mb" : "kb"),
+                    (unsigned long)page_faults );
   }
 }
 
@@ -188,9 +188,9 @@ static kk_ptr_t bigint_ptr_(kk_bigint_t* x) {
 }
 
 static kk_integer_t bigint_as_integer_(kk_bigint_t* x) {
-  uintptr_t p = (uintptr_t)bigint_ptr_(x);
-  kk_assert_internal((p&3) == 0);
-  kk_integer_t i = { p };  
+  kk_ptr_t p = bigint_ptr_(x);
+  kk_assert_internal(((uintptr_t)p&3) == 0);
+  kk_integer_t i = { kk_ptr_encode(p) };  
   return i;
 }
 
@@ -24,7 +24,7 @@ again: ;
   // we got it, and hold the "locked" reference (`r->value == 0`)
   kk_box_dup(b);
   // and release our lock by writing back `b`    
-  uintptr_t guard = 0;
+  kk_uintb_t guard = 0;
   while (!kk_atomic_cas_strong_relaxed(&r->value, &guard, b.box)) { 
     assert(false); 
     // should never happen! as a last resort, restart the operation
@@ -393,21 +393,41 @@ static kk_decl_noinline void kk_block_drop_free_recx(kk_block_t* b, kk_context_t
 #define MAX_RECURSE_DEPTH (100)
 
 // Stackless marking is more expensive so we switch to this only after recursing first.
-static kk_decl_noinline void kk_block_mark_shared_recx(kk_block_t* b, kk_context_t* ctx);
+// The same traversal is used to mark values immortal (with a stuck reference count),
+// which we use for the top-level values of modules after initialization.
+static kk_decl_noinline void kk_block_mark_shared_recx(kk_block_t* b, bool immortal, kk_context_t* ctx);
 
+static void kk_block_make_immortal(kk_block_t* b) {
+  kk_block_refcount_set(b, RC_STUCK);        // never dup/drop or freed anymore (like static data)
+}
+
+static bool kk_block_is_immortal(kk_block_t* b) {
+  const kk_refcount_t rc = kk_block_refcount(b);
+  return (rc >= RC_STUCK && rc <= RC_STICKY_DROP);
+}
+
+static inline bool kk_block_is_marked(kk_block_t* b, bool immortal) {
+  return (immortal ? kk_block_is_immortal(b) : kk_block_is_thread_shared(b));
+}
 
-// Check if a field `i` in a block `b` should be marked, i.e. it is heap allocated and not yet thread shared.
+static inline void kk_block_mark(kk_block_t* b, bool immortal) {
+  if (immortal) { kk_block_make_immortal(b); }
+           else { kk_block_make_shared(b); }
+}
+
+
+// Check if a field `i` in a block `b` should be marked, i.e. it is heap allocated and not yet thread shared (or immortal).
 // Optimizes by already marking leaf blocks that have no scan fields.
-static inline kk_block_t* kk_block_field_should_mark(kk_block_t* b, kk_ssize_t field, kk_context_t* ctx)
+static inline kk_block_t* kk_block_field_should_mark(kk_block_t* b, kk_ssize_t field, bool immortal, kk_context_t* ctx)
 {
   kk_unused(ctx);
   kk_box_t v = kk_block_field(b, field);
   if (kk_box_is_non_null_ptr(v)) {
     kk_block_t* child = kk_ptr_unbox(v);
-    if (!kk_block_is_thread_shared(child)) {
+    if (!kk_block_is_marked(child, immortal)) {
       if (child->header.scan_fsize == 0) {
         // mark leaf objects directly as shared
-        kk_block_make_shared(child);
+        kk_block_mark(child, immortal);
       }
       else {
         return child;
@@ -418,10 +438,10 @@ static inline kk_block_t* kk_block_field_should_mark(kk_block_t* b, kk_ssize_t f
 }
   
 // Recurse up to `depth` while marking objects
-static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ssize_t depth, kk_context_t* ctx) 
+static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ssize_t depth, bool immortal, kk_context_t* ctx) 
 {
   while(true) {
-    if (kk_block_is_thread_shared(b)) {
+    if (kk_block_is_marked(b, immortal)) {
       return;
     } 
     
@@ -429,8 +449,8 @@ static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ss
     kk_assert_internal(scan_fsize > 0);
     if (scan_fsize == 1) {
       // if just one field, we can recursively scan without using stack space
-      kk_block_make_shared(b);
-      kk_block_t* child = kk_block_field_should_mark(b, 0, ctx);
+      kk_block_mark(b, immortal);
+      kk_block_t* child = kk_block_field_should_mark(b, 0, immortal, ctx);
       if (child != NULL) {
         // try to mark the child now
         b = child;
@@ -440,8 +460,8 @@ static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ss
     }
     else if (scan_fsize == 2 && !kk_box_is_non_null_ptr(kk_block_field(b, 0))) {
       // optimized code for lists/nodes with boxed first element
-      kk_block_make_shared(b);
-      kk_block_t* child = kk_block_field_should_mark(b, 1, ctx);
+      kk_block_mark(b, immortal);
+      kk_block_t* child = kk_block_field_should_mark(b, 1, immortal, ctx);
       if (child != NULL) {
         b = child;
         continue; // tailcall
@@ -451,7 +471,7 @@ static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ss
     else {
       // more than 1 field
       if (depth < MAX_RECURSE_DEPTH) {
-        kk_block_make_shared(b);
+        kk_block_mark(b, immortal);
         kk_ssize_t i = 0;
         if (kk_unlikely(scan_fsize >= KK_SCAN_FSIZE_MAX)) { 
           scan_fsize = (kk_ssize_t)kk_intf_unbox(kk_block_field(b, 0)); 
@@ -459,13 +479,13 @@ static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ss
         }
         // mark fields up to the last one
         for (; i < (scan_fsize-1); i++) {
-          kk_block_t* child = kk_block_field_should_mark(b, i, ctx);
+          kk_block_t* child = kk_block_field_should_mark(b, i, immortal, ctx);
           if (child != NULL) {
-            kk_block_mark_shared_rec(child, depth+1, ctx); // recurse with increased depth
+            kk_block_mark_shared_rec(child, depth+1, immortal, ctx); // recurse with increased depth
           }          
         }
         // and recurse into the last one
-        kk_block_t* child = kk_block_field_should_mark(b, i, ctx);
+        kk_block_t* child = kk_block_field_should_mark(b, i, immortal, ctx);
         if (child != NULL) {
           b = child;
           scan_fsize = b->header.scan_fsize;
@@ -475,7 +495,7 @@ static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ss
       }
       else {
         // max recursion depth reached: switch to stackless marking
-        kk_block_mark_shared_recx(b, ctx);
+        kk_block_mark_shared_recx(b, immortal, ctx);
         return;
       }
     }
@@ -485,22 +505,22 @@ static kk_decl_noinline void kk_block_mark_shared_rec(kk_block_t* b, const kk_ss
 
 
 // mark a large vector
-static kk_decl_noinline void kk_block_mark_shared_recx_large(kk_block_t* b, kk_context_t* ctx) {
+static kk_decl_noinline void kk_block_mark_shared_recx_large(kk_block_t* b, bool immortal, kk_context_t* ctx) {
   kk_assert_internal(b->header.scan_fsize == KK_SCAN_FSIZE_MAX);
   kk_ssize_t scan_fsize = kk_block_scan_fsize(b);
   for (kk_ssize_t i = 1; i < scan_fsize; i++) {  // start at 1 to skip the large scan field itself
-    if (kk_block_field_should_mark(b, i, ctx)) {
-      kk_block_mark_shared_recx(b, ctx);
+    if (kk_block_field_should_mark(b, i, immortal, ctx)) {
+      kk_block_mark_shared_recx(b, immortal, ctx);
     }
   }
-  kk_block_make_shared(b);
+  kk_block_mark(b, immortal);
 }
 
 // Stackless marking by using pointer reversal
-static kk_decl_noinline void kk_block_mark_shared_recx(kk_block_t* b, kk_context_t* ctx) 
+static kk_decl_noinline void kk_block_mark_shared_recx(kk_block_t* b, bool immortal, kk_context_t* ctx) 
 {
   kk_block_t* parent = NULL;
-  if (kk_block_is_thread_shared(b)) return;
+  if (kk_block_is_marked(b, immortal)) return;
   if (b->header.scan_fsize == 0) return;
   uint8_t i = 0;
   uint8_t scan_fsize = b->header.scan_fsize;
@@ -510,11 +530,11 @@ markfields:
   kk_assert_internal(scan_fsize > 0);
   if (scan_fsize == KK_SCAN_FSIZE_MAX) {
     // recurse over the stack for large objects (vectors)
-    kk_block_mark_shared_recx_large(b, ctx);
+    kk_block_mark_shared_recx_large(b, immortal, ctx);
   }
   else {
     do {
-      kk_block_t* child = kk_block_field_should_mark(b, i, ctx);
+      kk_block_t* child = kk_block_field_should_mark(b, i, immortal, ctx);
       i++;
       if (child != NULL) {
         // move down 
@@ -528,7 +548,7 @@ markfields:
         goto markfields;
       }
     } while (i < scan_fsize);
-    kk_block_make_shared(b);
+    kk_block_mark(b, immortal);
   }
 
   //--- moving back up ------------------
@@ -544,7 +564,7 @@ markfields:
     if (i >= scan_fsize) {
       kk_assert_internal(i == scan_fsize);
       // done, keep moving up
-      kk_block_make_shared(b);
+      kk_block_mark(b, immortal);
     }
     else {
       // mark the rest of the fields starting at `i` upto `scan_fsize`
@@ -561,7 +581,7 @@ kk_decl_export void kk_block_mark_shared( kk_block_t* b, kk_context_t* ctx ) {
       kk_block_make_shared(b); // no scan fields
     }
     else {
-      kk_block_mark_shared_rec(b, 0, ctx);
+      kk_block_mark_shared_rec(b, 0, false, ctx);
     }
   }
 }
@@ -575,6 +595,24 @@ kk_decl_export void kk_box_mark_shared( kk_box_t b, kk_context_t* ctx ) {
 
 kk_decl_export void kk_box_mark_shared_recx(kk_box_t b, kk_context_t* ctx) {
   if (kk_box_is_non_null_ptr(b)) {
-    kk_block_mark_shared_recx(kk_ptr_unbox(b), ctx);
+    kk_block_mark_shared_recx(kk_ptr_unbox(b), false, ctx);
+  }
+}
+
+// Mark a block and its children as immortal: they are never freed and dup/drop become no-ops.
+kk_decl_export void kk_block_mark_immortal( kk_block_t* b, kk_context_t* ctx ) {
+  if (!kk_block_is_immortal(b)) {
+    if (b->header.scan_fsize == 0) {
+      kk_block_make_immortal(b); // no scan fields
+    }
+    else {
+      kk_block_mark_shared_rec(b, 0, true, ctx);
+    }
+  }
+}
+
+kk_decl_export void kk_box_mark_immortal( kk_box_t b, kk_context_t* ctx ) {
+  if (kk_box_is_non_null_ptr(b)) {
+    kk_block_mark_immortal( kk_ptr_unbox(b), ctx );
   }
 }
@@ -0,0 +1,96 @@
+/*---------------------------------------------------------------------------
+  Copyright 2021, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------------------------------
+  Interactive evaluation host
+  The interpreter links the loaded modules once into a host executable (exporting its symbols)
+  and compiles each expression into a small shared object that is loaded into the running host.
+  Module initialization runs only on first use and imported modules are never finalized, so
+  their state persists between evaluations.
+
+  This file is the `main` of the host and is not part of `all.c`: only the host links with the
+  dynamic loader. The interpreter passes two extra file descriptors in `KK_REPL_FDS` as
+  `<command>,<reply>`: the host reads the path of each shared object as a line from the command
+  channel and writes `KK_REPL_DONE` to the reply channel when it is evaluated. The standard
+  input, output, and error stay with the evaluated program. Without `KK_REPL_FDS` the host
+  reads commands from `stdin` and replies on `stderr`.
+--------------------------------------------------------------------------------------------------*/
+#include "kklib.h"
+
+#if defined(WIN32)
+static void* kk_repl_load(const char* path, const char** err) {
+  HMODULE h = LoadLibraryA(path);
+  if (h == NULL) { *err = "unable to load library"; return NULL; }
+  void* entry = (void*)GetProcAddress(h, "kk_repl_entry");
+  if (entry == NULL) { *err = "unable to find the entry point (kk_repl_entry)"; }
+  return entry;
+}
+#elif defined(__wasi__) || defined(__EMSCRIPTEN__)
+static void* kk_repl_load(const char* path, const char** err) {
+  kk_unused(path);
+  *err = "dynamic loading is not supported on this platform";
+  return NULL;
+}
+#else
+#include <dlfcn.h>
+static void* kk_repl_load(const char* path, const char** err) {
+  void* h = dlopen(path, RTLD_NOW | RTLD_LOCAL);   // never closed as it may still be referenced
+  if (h == NULL) { *err = dlerror(); return NULL; }
+  void* entry = dlsym(h, "kk_repl_entry");
+  if (entry == NULL) { *err = dlerror(); }
+  return entry;
+}
+#endif
+
+// open the command and reply channels
+static bool kk_repl_channels(FILE** cmds, FILE** reply) {
+  *cmds  = stdin;
+  *reply = stderr;
+  const char* fds = getenv("KK_REPL_FDS");
+  if (fds == NULL) return true;
+  int cmd_fd = -1;
+  int reply_fd = -1;
+  if (sscanf(fds, "%d,%d", &cmd_fd, &reply_fd) != 2 || cmd_fd < 0 || reply_fd < 0) return false;
+  *cmds  = fdopen(cmd_fd, "r");
+  *reply = fdopen(reply_fd, "w");
+  #if !defined(WIN32)
+  unsetenv("KK_REPL_FDS");  // not inherited by processes started from evaluated code
+  #endif
+  return (*cmds != NULL && *reply != NULL);
+}
+
+int main(int argc, char** argv) {
+  FILE* cmds;
+  FILE* reply;
+  if (!kk_repl_channels(&cmds, &reply)) {
+    fprintf(stderr, "error: invalid interactive host channels (KK_REPL_FDS)\n");
+    return 1;
+  }
+  kk_context_t* ctx = kk_main_start(argc, argv);
+  char path[4096];
+  while (fgets(path, sizeof(path), cmds) != NULL) {
+    size_t len = strlen(path);
+    while (len > 0 && (path[len-1] == '\n' || path[len-1] == '\r')) { path[--len] = 0; }
+    if (len == 0) continue;
+    const char* err = NULL;
+    kk_repl_entry_fun_t* entry = (kk_repl_entry_fun_t*)kk_repl_load(path, &err);
+    if (entry == NULL) {
+      fprintf(stderr, "error: %s\n", (err == NULL ? path : err));
+    }
+    else {
+      entry(ctx);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    kk_log_flush();
+    fputs(KK_REPL_DONE "\n", reply);
+    fflush(reply);
+  }
+  kk_main_end(ctx);
+  return 0;
+}
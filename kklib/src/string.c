@@ -400,7 +400,9 @@ kk_string_t kk_string_convert_from_qutf8(kk_bytes_t str, kk_context_t* ctx) {
 }
 
 
-const char* kk_string_to_qutf8_borrow(kk_string_t str, bool* should_free, kk_context_t* ctx) {
+// Raw code points (from invalid utf-8 input) are converted back to the original bytes.
+// The byte length of the result is returned in `qlen` (if not NULL).
+const char* kk_string_to_qutf8n_borrow(kk_string_t str, kk_ssize_t* qlen, bool* should_free, kk_context_t* ctx) {
   // to avoid allocation, we first check if none of the characters are in the raw range.
   kk_ssize_t len;
   const uint8_t* const s = kk_string_buf_borrow(str, &len);
@@ -417,13 +419,14 @@ const char* kk_string_to_qutf8_borrow(kk_string_t str, bool* should_free, kk_con
       kk_ssize_t count;
       kk_char_t c = kk_utf8_read(p, &count);
       p += count;
-      if (c >= KK_RAW_UTF8_OFS && c <= KK_RAW_UTF8_OFS + 0x7F) {
+      if (c >= KK_RAW_UTF8_OFS + 0x80 && c <= KK_RAW_UTF8_OFS + 0xFF) {
         extra_count += 3;  // encoded as 4 utf bytes but just 1 output byte needed
       }
     }
   }
   kk_assert_internal(p == end);
   if (extra_count == 0) {
+    if (qlen != NULL) *qlen = len;
     *should_free = false;
     return (const char*)s;
   }
@@ -445,7 +448,7 @@ const char* kk_string_to_qutf8_borrow(kk_string_t str, bool* should_free, kk_con
       kk_ssize_t count;
       kk_char_t c = kk_utf8_read(p, &count);
       p += count;
-      if (c >= KK_RAW_UTF8_OFS && c <= KK_RAW_UTF8_OFS + 0x7F) {
+      if (c >= KK_RAW_UTF8_OFS + 0x80 && c <= KK_RAW_UTF8_OFS + 0xFF) {
         *q++ = (uint8_t)(c - KK_RAW_UTF8_OFS);
       }
       else {
@@ -456,10 +459,15 @@ const char* kk_string_to_qutf8_borrow(kk_string_t str, bool* should_free, kk_con
   }
   kk_assert_internal(p == end);
   kk_assert_internal(q == bstr + blen && *q == 0);
+  if (qlen != NULL) *qlen = blen;
   *should_free = true;
   return (const char*)bstr;
 }
 
+const char* kk_string_to_qutf8_borrow(kk_string_t str, bool* should_free, kk_context_t* ctx) {
+  return kk_string_to_qutf8n_borrow(str, NULL, should_free, ctx);
+}
+
 
 /*--------------------------------------------------------------------------------------------------
   qutf-16 encoding/decoding
@@ -865,17 +873,23 @@ kk_unit_t kk_print(kk_string_t s, kk_context_t* ctx) {
   return kk_Unit;
 }
 
+// Traces are written synchronously: they are often the last output before a crash.
 kk_unit_t kk_trace(kk_string_t s, kk_context_t* ctx) {
-  fputs(kk_string_cbuf_borrow(s, NULL), stderr); // todo: allow printing embedded 0 characters?
-  fputs("\n", stderr);
+  kk_ssize_t len;
+  const char* buf = kk_string_cbuf_borrow(s, &len);
+  kk_log_line_now(KK_LOG_TRACE, buf, (size_t)len);
   kk_string_drop(s, ctx);
   return kk_Unit;
 }
 
 kk_unit_t kk_trace_any(kk_string_t s, kk_box_t x, kk_context_t* ctx) {
-  fprintf(stderr, "%s: ", kk_string_cbuf_borrow(s, NULL));
-  kk_string_drop(s, ctx);
-  kk_trace(kk_show_any(x, ctx), ctx);
+  if (!kk_log_enabled(KK_LOG_TRACE)) {
+    kk_string_drop(s, ctx);
+    kk_box_drop(x, ctx);
+    return kk_Unit;
+  }
+  kk_string_t sep = kk_string_alloc_dup_valid_utf8(": ", ctx);
+  kk_trace(kk_string_cat(kk_string_cat(s, sep, ctx), kk_show_any(x, ctx), ctx), ctx);
   return kk_Unit;
 }
 
@@ -594,3 +594,326 @@ kk_box_t kk_lvar_get( kk_lvar_t lvar, kk_box_t bot, kk_function_t is_gte, kk_con
   kk_box_drop(lvar,ctx);
   return result;
 }
+
+
+/*---------------------------------------------------------------------------
+  Lazy top-level values
+  The first thread that uses a value moves its state from uninitialized to
+  running and computes it; other threads that use it at the same time wait
+  until it is done. Top-level values are never cyclic, so a thread never
+  waits on a value that it is computing itself.
+---------------------------------------------------------------------------*/
+
+static pthread_once_t  kk_lazy_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t kk_lazy_lock;
+static pthread_cond_t  kk_lazy_done;
+
+static void kk_lazy_init(void) {
+  pthread_mutex_init(&kk_lazy_lock, NULL);
+  pthread_cond_init(&kk_lazy_done, NULL);
+}
+
+kk_decl_export bool kk_lazy_value_enter(_Atomic(int32_t)* state) {
+  int32_t expected = KK_LAZY_UNINIT;
+  if (kk_atomic_cas_strong_acq_rel(state, &expected, KK_LAZY_RUNNING)) return true;
+  if (expected == KK_LAZY_DONE) return false;
+  // another thread is computing the value
+  pthread_once(&kk_lazy_once, &kk_lazy_init);
+  pthread_mutex_lock(&kk_lazy_lock);
+  while (kk_atomic_load_acquire(state) != KK_LAZY_DONE) {
+    pthread_cond_wait(&kk_lazy_done, &kk_lazy_lock);
+  }
+  pthread_mutex_unlock(&kk_lazy_lock);
+  return false;
+}
+
+kk_decl_export void kk_lazy_value_leave(_Atomic(int32_t)* state) {
+  pthread_once(&kk_lazy_once, &kk_lazy_init);
+  pthread_mutex_lock(&kk_lazy_lock);
+  kk_atomic_store_release(state, KK_LAZY_DONE);
+  pthread_cond_broadcast(&kk_lazy_done);
+  pthread_mutex_unlock(&kk_lazy_lock);
+}
+
+/*---------------------------------------------------------------------------
+  Asynchronous logging
+  Each thread formats its records into its own lock-free ring buffer
+  (with a single producer, and the consumer under `kk_log_lock`).
+  A background thread, started with the first record, regularly drains
+  all rings and writes them in one batch to the sink: `stderr` or the file
+  given by `KK_LOG_FILE`. Records above the level in `KK_LOG_LEVEL` are
+  dropped before they are formatted. A full ring, fatal errors, and
+  `kk_log_flush` drain synchronously; with `KK_LOG_SYNC=1` each record
+  is written directly. Rings are kept for the lifetime of the process.
+---------------------------------------------------------------------------*/
+#include <stdarg.h>
+#include <time.h>
+
+#define KK_LOG_RING_SIZE    (64*1024)
+#define KK_LOG_MAX_RECORD   (4*1024)     // longer events are truncated
+#define KK_LOG_INTERVAL_MS  (10)         // flush interval of the background thread
+
+typedef struct kk_log_ring_s {
+  struct kk_log_ring_s* next;
+  size_t                id;              // shown as `thread=<id>` in events
+  _Atomic(size_t)       head;            // total bytes written by the owning thread
+  _Atomic(size_t)       tail;            // total bytes written to the sink
+  char                  buf[KK_LOG_RING_SIZE];
+} kk_log_ring_t;
+
+typedef enum kk_log_state_e {
+  KK_LOG_IDLE,       // no background thread yet
+  KK_LOG_RUNNING,
+  KK_LOG_STOPPED     // at exit, or unable to start the thread: write directly
+} kk_log_state_t;
+
+static pthread_once_t                kk_log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t               kk_log_lock;        // serializes draining and writing to the sink
+static pthread_t                     kk_log_thread;
+static FILE*                         kk_log_file;        // NULL for `stderr`
+static bool                          kk_log_sync;
+static _Atomic(int)                  kk_log_level = KK_LOG_TRACE;
+static _Atomic(int)                  kk_log_state;       // = KK_LOG_IDLE
+static _Atomic(kk_log_ring_t*)       kk_log_rings;
+static _Atomic(size_t)               kk_log_ring_count;
+static kk_decl_thread kk_log_ring_t* kk_log_ring;
+
+static const char* kk_log_level_names[] = { "fatal", "error", "warning", "info", "debug", "trace" };
+
+static void kk_log_done(void);
+
+static void kk_log_init(void) {
+  pthread_mutex_init(&kk_log_lock, NULL);
+  const char* s = getenv("KK_LOG_LEVEL");
+  if (s != NULL) {
+    for (int level = KK_LOG_FATAL; level <= KK_LOG_TRACE; level++) {
+      if (strcmp(s, kk_log_level_names[level])==0 || (s[0] == '0' + level && s[1] == 0)) {
+        kk_atomic_store_relaxed(&kk_log_level, level);
+      }
+    }
+  }
+  s = getenv("KK_LOG_FILE");
+  if (s != NULL && *s != 0) {
+    kk_log_file = fopen(s, "a");
+  }
+  s = getenv("KK_LOG_SYNC");
+  kk_log_sync = (s != NULL && (strcmp(s, "1")==0 || strcmp(s, "on")==0 || strcmp(s, "true")==0));
+  atexit(&kk_log_done);
+}
+
+static void kk_log_ensure_init(void) {
+  pthread_once(&kk_log_once, &kk_log_init);
+}
+
+kk_decl_export bool kk_log_enabled(kk_log_level_t level) {
+  kk_log_ensure_init();
+  return ((int)level <= kk_atomic_load_relaxed(&kk_log_level));
+}
+
+kk_decl_export void kk_log_set_level(kk_log_level_t level) {
+  kk_log_ensure_init();
+  kk_atomic_store_relaxed(&kk_log_level, (int)level);
+}
+
+// Write to the file at `path` (appending) instead of `stderr`; returns `false` if the file cannot be opened.
+kk_decl_export bool kk_log_set_file(const char* path) {
+  kk_log_ensure_init();
+  FILE* f = fopen(path, "a");
+  if (f == NULL) return false;
+  pthread_mutex_lock(&kk_log_lock);
+  FILE* prev = kk_log_file;
+  kk_log_file = f;
+  pthread_mutex_unlock(&kk_log_lock);
+  if (prev != NULL) fclose(prev);
+  return true;
+}
+
+static void kk_log_write_locked(const char* buf, size_t len) {
+  FILE* f = (kk_log_file != NULL ? kk_log_file : stderr);
+  fwrite(buf, 1, len, f);
+  fflush(f);
+}
+
+// Write the pending records of all rings in batches.
+static void kk_log_drain_locked(void) {
+  static char batch[KK_LOG_RING_SIZE];
+  size_t n = 0;
+  for (kk_log_ring_t* ring = kk_atomic_load_acquire(&kk_log_rings); ring != NULL; ring = ring->next) {
+    const size_t head = kk_atomic_load_acquire(&ring->head);
+    size_t tail = kk_atomic_load_relaxed(&ring->tail);
+    while (tail < head) {
+      const size_t pos = tail % KK_LOG_RING_SIZE;
+      size_t len = head - tail;
+      if (len > KK_LOG_RING_SIZE - pos) len = KK_LOG_RING_SIZE - pos;
+      if (len > sizeof(batch) - n) len = sizeof(batch) - n;
+      memcpy(batch + n, ring->buf + pos, len);
+      n += len;
+      tail += len;
+      if (n == sizeof(batch)) {
+        kk_log_write_locked(batch, n);
+        n = 0;
+      }
+    }
+    kk_atomic_store_release(&ring->tail, tail);
+  }
+  if (n > 0) kk_log_write_locked(batch, n);
+}
+
+// Write all pending records.
+kk_decl_export void kk_log_flush(void) {
+  kk_log_ensure_init();
+  pthread_mutex_lock(&kk_log_lock);
+  kk_log_drain_locked();
+  pthread_mutex_unlock(&kk_log_lock);
+}
+
+static void kk_log_sleep_ms(int ms) {
+  #ifdef _WIN32
+  Sleep((DWORD)ms);
+  #else
+  struct timespec tm;
+  tm.tv_sec  = ms / 1000;
+  tm.tv_nsec = (long)(ms % 1000) * 1000000L;
+  nanosleep(&tm, NULL);
+  #endif
+}
+
+static void* kk_log_worker(void* arg) {
+  kk_unused(arg);
+  while (kk_atomic_load_acquire(&kk_log_state) == KK_LOG_RUNNING) {
+    kk_log_sleep_ms(KK_LOG_INTERVAL_MS);
+    kk_log_flush();
+  }
+  return NULL;
+}
+
+static void kk_log_done(void) {
+  // stop with a read-modify-write: a record published before it is written by the flush
+  // below, and a writer that publishes after it sees the stopped state (see `kk_log_write`)
+  int state = kk_atomic_load_relaxed(&kk_log_state);
+  while (!kk_atomic_cas_weak_acq_rel(&kk_log_state, &state, KK_LOG_STOPPED)) {}
+  if (state == KK_LOG_RUNNING) {
+    pthread_join_void(kk_log_thread);
+  }
+  kk_log_flush();
+}
+
+static kk_log_ring_t* kk_log_ring_get(void) {
+  kk_log_ring_t* ring = kk_log_ring;
+  if (ring != NULL) return ring;
+  ring = (kk_log_ring_t*)calloc(1, sizeof(kk_log_ring_t));
+  if (ring == NULL) return NULL;
+  ring->id = kk_atomic_add_relaxed(&kk_log_ring_count, 1) + 1;
+  kk_log_ring_t* rings = kk_atomic_load_relaxed(&kk_log_rings);
+  do {
+    ring->next = rings;
+  } while (!kk_atomic_cas_weak_acq_rel(&kk_log_rings, &rings, ring));
+  kk_log_ring = ring;
+  return ring;
+}
+
+// Write a record directly (after the pending ones).
+static void kk_log_write_now(const char* msg, size_t len, bool newline) {
+  pthread_mutex_lock(&kk_log_lock);
+  kk_log_drain_locked();
+  kk_log_write_locked(msg, len);
+  if (newline) kk_log_write_locked("\n", 1);
+  pthread_mutex_unlock(&kk_log_lock);
+}
+
+static void kk_log_write(const char* msg, size_t len, bool newline) {
+  kk_log_ensure_init();
+  int state = kk_atomic_load_acquire(&kk_log_state);
+  kk_log_ring_t* ring = (kk_log_sync || state == KK_LOG_STOPPED ? NULL : kk_log_ring_get());
+  if (ring == NULL || len + 1 > KK_LOG_RING_SIZE) {
+    kk_log_write_now(msg, len, newline);
+    return;
+  }
+  if (state == KK_LOG_IDLE && kk_atomic_cas_strong_acq_rel(&kk_log_state, &state, KK_LOG_RUNNING)) {
+    if (pthread_create(&kk_log_thread, NULL, &kk_log_worker, NULL) != 0) {
+      kk_atomic_store_release(&kk_log_state, KK_LOG_STOPPED);
+      kk_log_write_now(msg, len, newline);
+      return;
+    }
+  }
+  const size_t total = len + (newline ? 1 : 0);
+  const size_t head  = kk_atomic_load_relaxed(&ring->head);
+  while (head + total - kk_atomic_load_acquire(&ring->tail) > KK_LOG_RING_SIZE) {
+    kk_log_flush();  // the ring is full: write synchronously instead of dropping records
+  }
+  const size_t pos   = head % KK_LOG_RING_SIZE;
+  const size_t first = (len < KK_LOG_RING_SIZE - pos ? len : KK_LOG_RING_SIZE - pos);
+  memcpy(ring->buf + pos, msg, first);
+  memcpy(ring->buf, msg + first, len - first);
+  if (newline) ring->buf[(head + len) % KK_LOG_RING_SIZE] = '\n';
+  kk_atomic_store_release(&ring->head, head + total);
+  // if the log stopped meanwhile (at exit), the final flush may have missed this record:
+  // the read-modify-write is ordered with the one in `kk_log_done`
+  int running = KK_LOG_RUNNING;
+  if (!kk_atomic_cas_strong_acq_rel(&kk_log_state, &running, KK_LOG_RUNNING)) {
+    kk_log_flush();
+  }
+}
+
+kk_decl_export void kk_log_message(kk_log_level_t level, const char* msg) {
+  if (!kk_log_enabled(level)) return;
+  if (level == KK_LOG_FATAL) {
+    kk_log_write_now(msg, strlen(msg), false);
+  }
+  else {
+    kk_log_write(msg, strlen(msg), false);
+  }
+}
+
+// Write a message of `len` bytes (which may contain zeros) followed by a newline.
+kk_decl_export void kk_log_line(kk_log_level_t level, const char* msg, size_t len) {
+  if (!kk_log_enabled(level)) return;
+  kk_log_write(msg, len, true);
+}
+
+// Write directly without the background thread (for use before the runtime is initialized).
+kk_decl_export void kk_log_message_now(kk_log_level_t level, const char* msg) {
+  if (!kk_log_enabled(level)) return;
+  kk_log_write_now(msg, strlen(msg), false);
+}
+
+// Write a line directly (after the pending records) without the background thread.
+kk_decl_export void kk_log_line_now(kk_log_level_t level, const char* msg, size_t len) {
+  if (!kk_log_enabled(level)) return;
+  kk_log_write_now(msg, len, true);
+}
+
+// Write a structured event as `time=<secs> level=<level> thread=<id> event=<event> <fields>`
+// where `fmt` (if not NULL) formats the remaining fields (as `key=value` pairs).
+kk_decl_export void kk_log_event(kk_log_level_t level, const char* event, const char* fmt, ...) {
+  if (!kk_log_enabled(level)) return;  // filter before formatting
+  char buf[KK_LOG_MAX_RECORD];
+  const kk_log_ring_t* ring = kk_log_ring_get();
+  long long secs = (long long)time(NULL);
+  long usecs = 0;
+  #if defined(TIME_UTC)
+  struct timespec ts;
+  if (timespec_get(&ts, TIME_UTC) == TIME_UTC) {
+    secs  = (long long)ts.tv_sec;
+    usecs = ts.tv_nsec / 1000;
+  }
+  #endif
+  int n = snprintf(buf, sizeof(buf), "time=%lld.%06ld level=%s thread=%zu event=%s",
+                   secs, usecs, kk_log_level_names[level], (ring == NULL ? (size_t)0 : ring->id), event);
+  if (n < 0) return;
+  if (fmt != NULL && n < (int)sizeof(buf) - 1) {
+    buf[n++] = ' ';
+    va_list args;
+    va_start(args, fmt);
+    const int m = vsnprintf(buf + n, sizeof(buf) - (size_t)n, fmt, args);
+    va_end(args);
+    if (m > 0) n += m;
+  }
+  if (n > (int)sizeof(buf) - 1) n = (int)sizeof(buf) - 1;
+  if (level == KK_LOG_FATAL) {
+    kk_log_write_now(buf, (size_t)n, true);
+  }
+  else {
+    kk_log_write(buf, (size_t)n, true);
+  }
+}
@@ -0,0 +1,21 @@
+/*---------------------------------------------------------------------------
+  Copyright 2021, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+// An evaluated expression for the interactive host test (see `repl.c`): it reads a line
+// from the standard input and echoes it without a final newline.
+#include <stdio.h>
+#include <string.h>
+#include "kklib.h"
+
+kk_decl_export void kk_repl_entry(kk_context_t* ctx) {
+  kk_unused(ctx);
+  char line[256];
+  if (fgets(line, sizeof(line), stdin) == NULL) { strcpy(line, "<eof>"); }
+  line[strcspn(line, "\r\n")] = 0;
+  printf("read: %s;", line);
+  fprintf(stderr, "no newline");
+}
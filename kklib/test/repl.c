@@ -0,0 +1,86 @@
+/*---------------------------------------------------------------------------
+  Copyright 2021, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+// Test the protocol of the interactive host (`src/replhost.c`): commands and replies go over
+// their own channels, so the evaluated code can read the standard input and write output
+// without a final newline.
+//   usage: kkrepl-test <kkrepl-host> <shared object with kk_repl_entry>
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "kklib.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) { fprintf(stderr, "failed: %s\n", what); failures++; }
+}
+
+// read a file descriptor until the end of file
+static void read_all(int fd, char* buf, size_t size) {
+  size_t len = 0;
+  ssize_t n;
+  while (len + 1 < size && (n = read(fd, buf + len, size - len - 1)) > 0) { len += (size_t)n; }
+  buf[len] = 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) { fprintf(stderr, "usage: %s <host> <entry>\n", argv[0]); return 1; }
+  int cmd[2], reply[2], in[2], out[2], err[2];
+  if (pipe(cmd) != 0 || pipe(reply) != 0 || pipe(in) != 0 || pipe(out) != 0 || pipe(err) != 0) { perror("pipe"); return 1; }
+  pid_t pid = fork();
+  if (pid < 0) { perror("fork"); return 1; }
+  if (pid == 0) {
+    dup2(in[0], 0); dup2(out[1], 1); dup2(err[1], 2);
+    close(in[0]); close(in[1]); close(out[0]); close(out[1]); close(err[0]); close(err[1]);
+    close(cmd[1]); close(reply[0]);
+    char fds[64];
+    snprintf(fds, sizeof(fds), "%d,%d", cmd[0], reply[1]);
+    setenv("KK_REPL_FDS", fds, 1);
+    execl(argv[1], argv[1], (char*)NULL);
+    perror("exec");
+    _exit(127);
+  }
+  close(cmd[0]); close(reply[1]); close(in[0]); close(out[1]); close(err[1]);
+
+  // the user input; the host must leave it to the evaluated code
+  const char* input = "first\nsecond\n";
+  check(write(in[1], input, strlen(input)) == (ssize_t)strlen(input), "write input");
+  close(in[1]);
+
+  FILE* cmds    = fdopen(cmd[1], "w");
+  FILE* replies = fdopen(reply[0], "r");
+  char line[256];
+  fprintf(cmds, "%s\n%s\n/nonexistent/entry.so\n", argv[2], argv[2]);
+  fflush(cmds);
+  for (int i = 0; i < 3; i++) {
+    check(fgets(line, sizeof(line), replies) != NULL && strcmp(line, KK_REPL_DONE "\n") == 0, "reply after each evaluation");
+  }
+  fclose(cmds);   // the host exits at the end of its commands
+  int status = 0;
+
+  char output[1024];
+  char errors[1024];
+  read_all(out[0], output, sizeof(output));
+  read_all(err[0], errors, sizeof(errors));
+  waitpid(pid, &status, 0);
+  check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "host exit status");
+  check(strcmp(output, "read: first;read: second;") == 0, "evaluated code reads the standard input");
+  check(strstr(errors, "no newlineno newline") == errors, "standard error is passed through");
+  check(strstr(errors, "error:") != NULL, "load errors are reported");
+  check(fgets(line, sizeof(line), replies) == NULL, "no further replies");
+  fclose(replies);
+  if (failures > 0) {
+    fprintf(stderr, "output: %s\nerrors: %s\n", output, errors);
+    return 1;
+  }
+  puts("Success!");
+  return 0;
+}
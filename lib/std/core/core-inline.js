@@ -252,10 +252,11 @@ export function _unvlist(list) {
   return elems;
 }
 
-// Create a vector with a function initializer
-export function _vector(n, f) {
+// Create a vector with a function initializer;
+// `A` is the array type, like `Float64Array` for a vector of `float64` (see `jsTypeFormats` in the compiler)
+export function _vector(n, f, A) {
   if (n<=0) return [];
-  var a = new Array(n);
+  var a = (A===undefined ? new Array(n) : new A(n));
   for(var i = 0; i < n; i++) {
     a[i] = f(i);
   }
@@ -240,46 +240,102 @@ kk_string_t kk_evv_show(kk_evv_t evv, kk_context_t* ctx) {
   Compose continuations
 -----------------------------------------------------------------------*/
 
+// A composed continuation is an immutable segment of continuations that is shared
+// between all resumptions of a multi-shot continuation. Resuming a shared segment dups
+// each continuation just before it is called; if a continuation yields, the remaining
+// ones are passed on as a reference to the segment (see `kcompose_rest`) instead of
+// duplicating each of them.
 struct kcompose_fun_s {
   struct kk_function_s _base;
   kk_box_t      count;
-  kk_function_t conts[1];
+  kk_box_t      conts[1];   // kk_function_t's (see `kk_field_ptr_store`)
 };
 
-// kleisli composition of continuations
-static kk_box_t kcompose( kk_function_t fself, kk_box_t x, kk_context_t* ctx) {
-  struct kcompose_fun_s* self = kk_function_as(struct kcompose_fun_s*,fself);
+// the continuations of a segment from index `from` on
+struct kcompose_rest_fun_s {
+  struct kk_function_s _base;
+  kk_box_t      from;
+  kk_box_t      segment;    // kk_function_t (a `kcompose_fun_s`)
+};
+
+static kk_box_t kcompose_rest( kk_function_t fself, kk_box_t x, kk_context_t* ctx);
+
+static kk_function_t new_kcompose_rest( kk_function_t segment, kk_intx_t from, kk_context_t* ctx ) {
+  struct kcompose_rest_fun_s* self = kk_function_alloc_as(struct kcompose_rest_fun_s, 3, ctx);
+  self->_base.fun = kk_cfun_ptr_box(&kcompose_rest,ctx);
+  self->from = kk_intf_box(from);
+  self->segment = kk_field_ptr_store(segment);
+  return (&self->_base);
+}
+
+// call the continuations of segment `fseg` from index `from` on (and consume `fseg`)
+static kk_box_t kcompose_from( kk_function_t fseg, kk_intx_t from, kk_box_t x, kk_context_t* ctx) {
+  struct kcompose_fun_s* self = kk_function_as(struct kcompose_fun_s*,fseg);
   kk_intx_t count = kk_intf_unbox(self->count);
-  kk_function_t* conts = &self->conts[0];
+  kk_box_t* conts = &self->conts[0];
+  // if the segment is unique (the last resumption) we take ownership of the
+  // continuations in place and free the segment; otherwise we dup each continuation
+  const bool unique = kk_function_is_unique(fseg);
+  if (unique) {
+    // continuations before `from` were already called by an earlier resumption
+    for(kk_intx_t i = 0; i < from; i++) {
+      kk_function_drop(kk_field_ptr_load(kk_function_t, conts[i]),ctx);
+    }
+  }
   // call each continuation in order
-  for(kk_intx_t i = 0; i < count; i++) {
-    // todo: take uniqueness of fself into account to avoid dup_function
-    kk_function_t f = kk_function_dup(conts[i]);
+  for(kk_intx_t i = from; i < count; i++) {
+    kk_function_t f = kk_field_ptr_load(kk_function_t, conts[i]);
+    if (!unique) { kk_function_dup(f); }
     x = kk_function_call(kk_box_t, (kk_function_t, kk_box_t, kk_context_t*), f, (f, x, ctx));
     if (kk_yielding(ctx)) {
       // if yielding, `yield_next` all continuations that still need to be done
-      while(++i < count) {
-        // todo: if fself is unique, we could copy without dup?
-        kk_yield_extend(kk_function_dup(conts[i]),ctx);
+      i++;
+      if (unique) {
+        for( ; i < count; i++) {
+          kk_yield_extend(kk_field_ptr_load(kk_function_t, conts[i]),ctx);
+        }
+        kk_block_free(&fseg->_block,ctx);
+      }
+      else if (i < count - 1) {
+        kk_yield_extend(new_kcompose_rest(fseg,i,ctx),ctx);  // pass on our reference to the segment
+      }
+      else {
+        if (i < count) { kk_yield_extend(kk_function_dup(kk_field_ptr_load(kk_function_t, conts[i])),ctx); }
+        kk_function_drop(fseg,ctx);
       }
-      kk_function_drop(fself,ctx);
       kk_box_drop(x,ctx);     // still drop even though we yield as it may release a boxed value type?
       return kk_box_any(ctx); // return yielding
     }
   }
-  kk_function_drop(fself,ctx);
+  if (unique) { kk_block_free(&fseg->_block,ctx); }
+         else { kk_function_drop(fseg,ctx); }
   return x;
 }
 
+// kleisli composition of continuations
+static kk_box_t kcompose( kk_function_t fself, kk_box_t x, kk_context_t* ctx) {
+  return kcompose_from(fself, 0, x, ctx);
+}
+
+static kk_box_t kcompose_rest( kk_function_t fself, kk_box_t x, kk_context_t* ctx) {
+  struct kcompose_rest_fun_s* self = kk_function_as(struct kcompose_rest_fun_s*,fself);
+  kk_intx_t from = kk_intf_unbox(self->from);
+  kk_function_t segment = kk_field_ptr_load(kk_function_t, self->segment);
+  kk_drop_match(self,{kk_function_dup(segment);},{},ctx);
+  return kcompose_from(segment, from, x, ctx);
+}
+
 static kk_function_t new_kcompose( kk_function_t* conts, kk_ssize_t count, kk_context_t* ctx ) {
   if (count==0) return kk_function_id(ctx);
   if (count==1) return conts[0];
   struct kcompose_fun_s* f = kk_block_as(struct kcompose_fun_s*,
-                               kk_block_alloc(kk_ssizeof(struct kcompose_fun_s) - kk_ssizeof(kk_function_t) + (count*kk_ssizeof(kk_function_t)),
+                               kk_block_alloc(kk_ssizeof(struct kcompose_fun_s) - kk_ssizeof(kk_box_t) + (count*kk_ssizeof(kk_box_t)),
                                  2 + count /* scan size */, KK_TAG_FUNCTION, ctx));
   f->_base.fun = kk_cfun_ptr_box(&kcompose,ctx);
   f->count = kk_intf_box(count);
-  kk_memcpy(f->conts, conts, count * kk_ssizeof(kk_function_t));
+  for(kk_ssize_t i = 0; i < count; i++) {
+    f->conts[i] = kk_field_ptr_store(conts[i]);
+  }
   return (&f->_base);
 }
 
@@ -309,14 +365,14 @@ kk_box_t kk_yield_extend( kk_function_t next, kk_context_t* ctx ) {
 // cont_apply: \x -> f(cont,x)
 struct cont_apply_fun_s {
   struct kk_function_s _base;
-  kk_function_t f;
-  kk_function_t cont;
+  kk_box_t f;       // kk_function_t (see `kk_field_ptr_store`)
+  kk_box_t cont;    // kk_function_t
 };
 
 static kk_box_t cont_apply( kk_function_t fself, kk_box_t x, kk_context_t* ctx ) {
   struct cont_apply_fun_s* self = kk_function_as(struct cont_apply_fun_s*, fself);
-  kk_function_t f = self->f;
-  kk_function_t cont = self->cont;
+  kk_function_t f = kk_field_ptr_load(kk_function_t, self->f);
+  kk_function_t cont = kk_field_ptr_load(kk_function_t, self->cont);
   kk_drop_match(self,{kk_function_dup(f);kk_function_dup(cont);},{},ctx);
   return kk_function_call( kk_box_t, (kk_function_t, kk_function_t, kk_box_t, kk_context_t* ctx), f, (f, cont, x, ctx));
 }
@@ -324,8 +380,8 @@ static kk_box_t cont_apply( kk_function_t fself, kk_box_t x, kk_context_t* ctx )
 static kk_function_t kk_new_cont_apply( kk_function_t f, kk_function_t cont, kk_context_t* ctx ) {
   struct cont_apply_fun_s* self = kk_function_alloc_as(struct cont_apply_fun_s, 3, ctx);
   self->_base.fun = kk_cfun_ptr_box(&cont_apply,ctx);
-  self->f = f;
-  self->cont = cont;
+  self->f = kk_field_ptr_store(f);
+  self->cont = kk_field_ptr_store(cont);
   return (&self->_base);
 }
 
@@ -406,8 +462,8 @@ kk_unit_t  kk_evv_guard(kk_evv_t evv, kk_context_t* ctx) {
 
 typedef struct yield_info_s {
   struct kk_std_core_hnd__yield_info_s _base;
-  kk_function_t clause;
-  kk_function_t conts[KK_YIELD_CONT_MAX];
+  kk_box_t      clause;                   // kk_function_t (see `kk_field_ptr_store`)
+  kk_box_t      conts[KK_YIELD_CONT_MAX]; // kk_function_t's
   kk_ssize_t    conts_count;
   int32_t       marker;
   int8_t        yielding;
@@ -416,15 +472,16 @@ typedef struct yield_info_s {
 kk_std_core_hnd__yield_info kk_yield_capture(kk_context_t* ctx) {
   kk_assert_internal(kk_yielding(ctx));
   yield_info_t yld = kk_block_alloc_as(struct yield_info_s, 1 + KK_YIELD_CONT_MAX, (kk_tag_t)1, ctx);
-  yld->clause = ctx->yield.clause;
-  kk_ssize_t i = 0;
-  for( ; i < ctx->yield.conts_count; i++) {
-    yld->conts[i] = ctx->yield.conts[i];
+  yld->clause = kk_field_ptr_store(ctx->yield.clause);
+  // compose into a single shared segment so re-yielding only needs one dup
+  kk_ssize_t count = (ctx->yield.conts_count > 0 ? 1 : 0);
+  if (count > 0) {
+    yld->conts[0] = kk_field_ptr_store(new_kcompose(ctx->yield.conts, ctx->yield.conts_count, ctx));
   }
-  for( ; i < KK_YIELD_CONT_MAX; i++) {
-    yld->conts[i] = kk_function_null(ctx);
+  for(kk_ssize_t i = count; i < KK_YIELD_CONT_MAX; i++) {
+    yld->conts[i] = kk_field_ptr_store(kk_function_null(ctx));
   }
-  yld->conts_count = ctx->yield.conts_count;
+  yld->conts_count = count;
   yld->marker = ctx->yield.marker;
   yld->yielding = ctx->yielding;
   ctx->yielding = 0;
@@ -435,12 +492,12 @@ kk_std_core_hnd__yield_info kk_yield_capture(kk_context_t* ctx) {
 kk_box_t kk_yield_reyield( kk_std_core_hnd__yield_info yldinfo, kk_context_t* ctx) {
   kk_assert_internal(!kk_yielding(ctx));
   yield_info_t yld = kk_datatype_as_assert(yield_info_t, yldinfo, (kk_tag_t)1);
-  ctx->yield.clause = kk_function_dup(yld->clause);
+  ctx->yield.clause = kk_function_dup(kk_field_ptr_load(kk_function_t, yld->clause));
   ctx->yield.marker = yld->marker;
   ctx->yield.conts_count = yld->conts_count;
   ctx->yielding = yld->yielding;
   for(kk_ssize_t i = 0; i < yld->conts_count; i++) {
-    ctx->yield.conts[i] = kk_function_dup(yld->conts[i]);
+    ctx->yield.conts[i] = kk_function_dup(kk_field_ptr_load(kk_function_t, yld->conts[i]));
   }
   kk_constructor_drop(yld,ctx);
   return kk_box_any(ctx);
@@ -256,9 +256,21 @@ function _evv_swap_create(indices) {
 
 //--------------------------------------------------
 // Yielding
+//
+// This is the runtime for the monadic translation (shared with the C backend):
+// a yield is a global record that every monadic frame extends on the way back
+// to the prompt. The continuation array is only allocated once a frame extends
+// the yield. There is no generator or CPS based code generation (yet) that
+// would avoid the `_yielding()` checks after calls and the stack limit.
 //--------------------------------------------------
 
+function _kid(x) {
+  return x;
+}
+
 function _kcompose( to, conts ) {
+  if (to === 0) return _kid;
+  if (to === 1) return conts[0];
   return function(x) {
     var acc = x;
     for(var i = 0; i < to; i++) {
@@ -278,6 +290,7 @@ function _kcompose( to, conts ) {
 function _yield_extend(next) {
   _assert(_yielding(), "yield extension while not yielding!");
   if (_yield.final) return;
+  if (_yield.conts === null) _yield.conts = new Array(8);  // allocated on demand: many yields are never extended
   _yield.conts[_yield.conts_count++] = next;  // index is ~80% faster as push
 }
 
@@ -285,9 +298,8 @@ function _yield_cont(f) {
   _assert(_yielding(), "yield extension while not yielding!");
   if (_yield.final) return;
   const cont   = _kcompose(_yield.conts_count,_yield.conts);
-  _yield.conts = new Array(8);
+  _yield.conts = [function(x){ return f(cont,x); }];
   _yield.conts_count = 1;
-  _yield.conts[0] = function(x){ return f(cont,x); };
 }
 
 function _yield_prompt(m) {
@@ -312,7 +324,7 @@ export function _yield_final(m,clause) {
 
 export function _yield_to(m,clause) {
   _assert(!_yielding(),"yielding while yielding!");
-  _yield = { marker: m, clause: clause, conts: new Array(8), conts_count: 0, final: false };
+  _yield = { marker: m, clause: clause, conts: null, conts_count: 0, final: false };
 }
 
 function _yield_capture() {
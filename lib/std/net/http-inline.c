@@ -0,0 +1,342 @@
+/*---------------------------------------------------------------------------
+  Copyright 2021, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+
+/* Parsing of HTTP/1.1 requests into `sslice` views.
+   Requests are framed on the received bytes (as `Content-Length` counts bytes): the data of a
+   connection is received directly into a growable byte buffer. If the received data is valid
+   UTF-8 (the common case) the views of a request share the buffer as their string; otherwise
+   each complete request is decoded once into a string that the views of the request share.
+   A buffer that is shared with views is never written to again: new data is received into a
+   fresh buffer until all views are dropped.
+*/
+
+#if defined(_WIN32) || defined(__wasi__) || defined(__EMSCRIPTEN__)
+#define KK_HTTP_NO_RECV  1
+#else
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+#define KK_HTTP_MAX_HEADERS  (100)
+#define KK_HTTP_MAX_HEAD     (64*1024)
+#define KK_HTTP_MAX_BODY     (64*1024*1024)
+#define KK_HTTP_MIN_RECV     (4096)
+
+typedef struct kk_http_buffer_s {
+  kk_bytes_t bytes;     // owns `data` (of `cap` bytes)
+  uint8_t*   data;      // always has room for a zero byte after `len`
+  kk_ssize_t cap;
+  kk_ssize_t start;     // start of the next request
+  kk_ssize_t len;       // end of the received data
+  kk_ssize_t scan;      // the search for the end of the head resumes here
+  kk_ssize_t need;      // if the head was parsed already: the end of the request (or 0)
+  kk_ssize_t valid;     // `data[0,valid)` is valid UTF-8
+  bool       sealed;    // `bytes` is a string of length `len` that views may share
+} kk_http_buffer_t;
+
+static void kk_http_buffer_free( void* p, kk_block_t* b, kk_context_t* ctx ) {
+  kk_unused(b);
+  kk_http_buffer_t* buf = (kk_http_buffer_t*)p;
+  kk_bytes_drop(buf->bytes,ctx);
+  kk_free(buf,ctx);
+}
+
+static kk_box_t kk_http_buffer_create( kk_context_t* ctx ) {
+  kk_http_buffer_t* buf = (kk_http_buffer_t*)kk_malloc(kk_ssizeof(kk_http_buffer_t), ctx);
+  memset(buf, 0, sizeof(*buf));
+  buf->bytes = kk_bytes_empty();
+  return kk_cptr_raw_box(&kk_http_buffer_free, buf, ctx);
+}
+
+static void kk_http_bytes_set_length( kk_bytes_t b, kk_ssize_t len ) {
+  kk_bytes_normal_t nb = kk_datatype_as_assert(kk_bytes_normal_t, b, KK_TAG_BYTES);
+  nb->length = len;
+}
+
+// Make room to receive at least `KK_HTTP_MIN_RECV` bytes after `len`
+static void kk_http_buffer_reserve( kk_http_buffer_t* buf, kk_context_t* ctx ) {
+  const bool shared = (buf->sealed && !kk_datatype_is_unique(buf->bytes));
+  if (buf->sealed && !shared) {
+    // all views are dropped: use the buffer again
+    kk_http_bytes_set_length(buf->bytes, buf->cap);
+    buf->sealed = false;
+  }
+  if (!shared) {
+    if (buf->start == buf->len) {
+      buf->start = buf->len = buf->scan = buf->need = buf->valid = 0;
+    }
+    if (buf->cap - buf->len >= KK_HTTP_MIN_RECV) return;
+  }
+  const kk_ssize_t pending = buf->len - buf->start;
+  if (!shared && buf->start > 0 && buf->cap - pending >= KK_HTTP_MIN_RECV) {
+    // move the pending request to the front
+    memmove(buf->data, buf->data + buf->start, (size_t)pending);
+  }
+  else {
+    // copy the pending request to a new buffer (grown if needed); views keep sharing the old one
+    kk_ssize_t cap = (buf->cap < 4*KK_HTTP_MIN_RECV ? 4*KK_HTTP_MIN_RECV : buf->cap);
+    while (cap - pending < KK_HTTP_MIN_RECV) { cap *= 2; }
+    uint8_t* data;
+    kk_bytes_t bytes = kk_bytes_alloc_buf(cap, &data, ctx);
+    memcpy(data, buf->data + buf->start, (size_t)pending);
+    kk_bytes_drop(buf->bytes,ctx);
+    buf->bytes  = bytes;
+    buf->data   = data;
+    buf->cap    = cap;
+    buf->sealed = false;
+  }
+  buf->len  -= buf->start;
+  buf->scan  = (buf->scan > buf->start ? buf->scan - buf->start : 0);
+  buf->valid = (buf->valid > buf->start ? buf->valid - buf->start : 0);
+  if (buf->need > 0) buf->need -= buf->start;
+  buf->start = 0;
+  buf->data[buf->len] = 0;
+}
+
+// Receive the available bytes of socket `fd` directly into the buffer. Returns the number of
+// bytes received (0 once the peer closed the connection), or the `EAGAIN` error if there are none.
+static kk_std_core__error kk_http_buffer_recv( kk_box_t bbuf, kk_integer_t fd, kk_context_t* ctx ) {
+  kk_http_buffer_t* buf = (kk_http_buffer_t*)kk_cptr_raw_unbox(bbuf);
+  kk_box_drop(bbuf,ctx);
+  #if defined(KK_HTTP_NO_RECV)
+  kk_integer_drop(fd,ctx);
+  kk_unused(buf);
+  return kk_error_from_errno(ENOSYS,ctx);
+  #else
+  const int rfd = kk_integer_clamp32(fd,ctx);
+  kk_http_buffer_reserve(buf,ctx);
+  const ssize_t count = recv(rfd, buf->data + buf->len, (size_t)(buf->cap - buf->len), 0);
+  if (count < 0) return kk_error_from_errno(errno == EWOULDBLOCK ? EAGAIN : errno, ctx);
+  buf->len += count;
+  buf->data[buf->len] = 0;
+  return kk_error_ok(kk_integer_box(kk_integer_from_ssize_t(count,ctx)),ctx);
+  #endif
+}
+
+// Use the received data as a string that views can share. This is only possible if it is
+// valid UTF-8; the buffer is then not written to anymore while it is shared (see `kk_http_buffer_reserve`).
+static bool kk_http_buffer_seal( kk_http_buffer_t* buf ) {
+  if (buf->sealed) return true;
+  const uint8_t* s = buf->data;
+  kk_ssize_t i = buf->valid;
+  while (i < buf->len) {
+    if (s[i] < 0x80) { i++; continue; }
+    kk_ssize_t count;
+    kk_ssize_t vcount = 0;
+    kk_utf8_read_validate(s + i, &count, &vcount, false);
+    if (vcount != 0 || i + count > buf->len) break;  // invalid, or incomplete at the end
+    i += count;
+  }
+  buf->valid = i;
+  if (buf->valid < buf->len) return false;
+  kk_http_bytes_set_length(buf->bytes, buf->len);   // `data[len]` is zero
+  buf->sealed = true;
+  return true;
+}
+
+typedef struct kk_http_span_s {
+  kk_ssize_t start;
+  kk_ssize_t len;
+} kk_http_span_t;
+
+static char kk_http_tolower( char c ) {
+  return (c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c);
+}
+
+// compare with a lower-case ASCII string
+static bool kk_http_iequals_n( const char* s, kk_ssize_t n, const char* lower ) {
+  for (kk_ssize_t i = 0; i < n; i++) {
+    if (lower[i] == 0 || kk_http_tolower(s[i]) != lower[i]) return false;
+  }
+  return (lower[n] == 0);
+}
+
+static bool kk_http_iequals( kk_std_core__sslice slice, kk_string_t lower, kk_context_t* ctx ) {
+  const char* s = kk_string_cbuf_borrow(slice.str, NULL);
+  const bool eq = kk_http_iequals_n(s + slice.start, slice.len, kk_string_cbuf_borrow(lower, NULL));
+  kk_std_core__sslice_drop(slice,ctx);
+  kk_string_drop(lower,ctx);
+  return eq;
+}
+
+// find `\r\n` in `s[start,end)`; returns `end` if not found
+static kk_ssize_t kk_http_find_crlf( const char* s, kk_ssize_t start, kk_ssize_t end ) {
+  for (kk_ssize_t i = start; i + 1 < end; i++) {
+    const char* p = (const char*)memchr(s + i, '\r', (size_t)(end - 1 - i));
+    if (p == NULL) break;
+    i = (p - s);
+    if (p[1] == '\n') return i;
+  }
+  return end;
+}
+
+static kk_std_core_types__tuple2_ kk_http_result( kk_ssize_t end, kk_vector_t parts, kk_context_t* ctx ) {
+  return kk_std_core_types__new_dash__lp__comma__rp_( kk_integer_box(kk_integer_from_ssize_t(end,ctx)), kk_vector_box(parts,ctx), ctx );
+}
+
+// The length of the bytes `s[from,to)` once decoded (where an invalid byte takes 4 bytes as a raw code point).
+// Only used at positions followed by an ASCII byte where decoding a part gives the same as decoding the whole.
+static kk_ssize_t kk_http_decoded_len( const uint8_t* s, kk_ssize_t from, kk_ssize_t to ) {
+  kk_ssize_t n = 0;
+  for (kk_ssize_t i = from; i < to; ) {
+    if (s[i] < 0x80) { i++; n++; continue; }
+    kk_ssize_t count;
+    kk_ssize_t vcount = 0;
+    kk_utf8_read_validate(s + i, &count, &vcount, true);
+    i += count;
+    n += (vcount == 0 ? count : vcount);
+  }
+  return n;
+}
+
+// Parse the next request in the buffer as `(end,parts)` where `parts` are the views
+// `[method,target,version,body,name1,value1,...]` into the request, and `end` is the
+// number of bytes of the request. `end` is 0 if the request is not complete yet, and -1 if it
+// is malformed (or unsupported).
+static kk_std_core_types__tuple2_ kk_http_parse_request( kk_box_t bbuf, kk_context_t* ctx ) {
+  kk_http_buffer_t* buf = (kk_http_buffer_t*)kk_cptr_raw_unbox(bbuf);
+  kk_box_drop(bbuf,ctx);
+  const char* s = (const char*)buf->data;
+  const kk_ssize_t len = buf->len;
+  kk_ssize_t end = 0;
+  kk_http_span_t spans[4 + 2*KK_HTTP_MAX_HEADERS];
+  int count = 0;
+  // ignore empty lines before a request (RFC 7230, 3.5)
+  while (buf->start + 1 < len && s[buf->start] == '\r' && s[buf->start+1] == '\n') { buf->start += 2; }
+  const kk_ssize_t start = buf->start;
+  if (buf->need > len) goto done;  // the body is not complete yet
+  // find the end of the head, resuming where the previous search stopped
+  kk_ssize_t head_end = -1;
+  for (kk_ssize_t i = kk_http_find_crlf(s, (buf->scan > start ? buf->scan : start), len); i + 3 < len; i = kk_http_find_crlf(s, i + 1, len)) {
+    if (s[i+2] == '\r' && s[i+3] == '\n') { head_end = i; break; }
+  }
+  if (head_end < 0) {
+    buf->scan = (len - 3 > start ? len - 3 : start);
+    end = (len - start > KK_HTTP_MAX_HEAD ? -1 : 0);
+    goto done;
+  }
+  // request line: method SP target SP version
+  {
+    const kk_ssize_t line_end = kk_http_find_crlf(s, start, head_end + 2);
+    kk_ssize_t p = start;
+    for (int i = 0; i < 3; i++) {
+      kk_ssize_t q = p;
+      while (q < line_end && s[q] != ' ') q++;
+      if (q == p || (i < 2 && q == line_end) || (i == 2 && q != line_end)) { end = -1; goto done; }
+      spans[count].start = p;
+      spans[count].len   = q - p;
+      count++;
+      p = q + 1;
+    }
+    // the body goes at index 3; filled in once the content length is known
+    count++;
+    p = line_end + 2;
+    // headers: name ":" OWS value OWS
+    kk_ssize_t content_length = -1;
+    while (p < head_end + 2) {
+      const kk_ssize_t le = kk_http_find_crlf(s, p, head_end + 2);
+      const char* colon = (const char*)memchr(s + p, ':', (size_t)(le - p));
+      if (colon == NULL || colon == s + p || count + 2 > 4 + 2*KK_HTTP_MAX_HEADERS) { end = -1; goto done; }
+      const kk_ssize_t nend = (colon - s);
+      kk_ssize_t vstart = nend + 1;
+      kk_ssize_t vend   = le;
+      while (vstart < vend && (s[vstart] == ' ' || s[vstart] == '\t')) vstart++;
+      while (vend > vstart && (s[vend-1] == ' ' || s[vend-1] == '\t')) vend--;
+      if (kk_http_iequals_n(s + p, nend - p, "content-length")) {
+        kk_ssize_t n = 0;
+        if (vstart == vend) { end = -1; goto done; }
+        for (kk_ssize_t i = vstart; i < vend; i++) {
+          if (s[i] < '0' || s[i] > '9' || n > KK_HTTP_MAX_BODY) { end = -1; goto done; }
+          n = 10*n + (s[i] - '0');
+        }
+        // a repeated content length must have the same value (RFC 7230, 3.3.3)
+        if (content_length >= 0 && content_length != n) { end = -1; goto done; }
+        content_length = n;
+      }
+      else if (kk_http_iequals_n(s + p, nend - p, "transfer-encoding")) {
+        end = -1;  // chunked requests are not supported
+        goto done;
+      }
+      spans[count].start = p;
+      spans[count].len   = nend - p;
+      spans[count+1].start = vstart;
+      spans[count+1].len   = vend - vstart;
+      count += 2;
+      p = le + 2;
+    }
+    if (content_length < 0) content_length = 0;
+    const kk_ssize_t body_start = head_end + 4;
+    if (content_length > KK_HTTP_MAX_BODY) { end = -1; goto done; }
+    spans[3].start = body_start;
+    spans[3].len   = content_length;
+    end = body_start + content_length;
+    if (len < end) {
+      buf->need = end;   // do not parse the head again until the body is complete
+      end = 0;
+      goto done;
+    }
+  }
+
+done:
+  if (end <= 0) {
+    return kk_http_result(end, kk_vector_empty(), ctx);
+  }
+  const kk_ssize_t rlen = end - buf->start;
+  kk_box_t* elems;
+  kk_vector_t parts = kk_vector_alloc_uninit(count, &elems, ctx);
+  if (kk_http_buffer_seal(buf)) {
+    // the views share the received data
+    kk_string_t str = kk_unsafe_bytes_as_string(buf->bytes);
+    for (int i = 0; i < count; i++) {
+      kk_std_core__sslice view = kk_std_core__new_Sslice(kk_string_dup(str), spans[i].start, spans[i].len, ctx);
+      elems[i] = kk_std_core__sslice_box(view,ctx);
+    }
+  }
+  else {
+    // decode the request; the byte after it is temporarily zero so decoding stops at the end
+    const uint8_t* r = buf->data + buf->start;
+    const uint8_t next = buf->data[end];
+    buf->data[end] = 0;
+    kk_string_t str = kk_string_alloc_from_qutf8n(rlen, (const char*)r, ctx);
+    // translate the byte offsets if invalid UTF-8 was decoded as raw code points; the spans
+    // are visited in order of their position (the body at index 3 is last)
+    const bool identity = (kk_string_len_borrow(str) == rlen);
+    kk_ssize_t at  = start;  // raw offset
+    kk_ssize_t dat = 0;      // decoded offset of `at`
+    for (int k = 0; k < count; k++) {
+      const int i = (k < 3 ? k : (k == count - 1 ? 3 : k + 1));
+      kk_ssize_t vstart = spans[i].start - start;
+      kk_ssize_t vlen   = spans[i].len;
+      if (!identity) {
+        dat += kk_http_decoded_len(buf->data, at, spans[i].start);
+        vstart = dat;
+        vlen   = kk_http_decoded_len(buf->data, spans[i].start, spans[i].start + spans[i].len);
+        dat += vlen;
+        at   = spans[i].start + spans[i].len;
+      }
+      kk_std_core__sslice view = kk_std_core__new_Sslice(kk_string_dup(str), vstart, vlen, ctx);
+      elems[i] = kk_std_core__sslice_box(view,ctx);
+    }
+    buf->data[end] = next;
+    kk_string_drop(str,ctx);
+  }
+  buf->start = buf->scan = end;
+  buf->need  = 0;
+  return kk_http_result(rlen, parts, ctx);
+}
+
+// The number of bytes written for `s`
+static kk_integer_t kk_http_byte_length( kk_string_t s, kk_context_t* ctx ) {
+  kk_ssize_t n;
+  bool should_free;
+  const char* bytes = kk_string_to_qutf8n_borrow(s, &n, &should_free, ctx);
+  if (should_free) kk_free(bytes,ctx);
+  kk_string_drop(s,ctx);
+  return kk_integer_from_ssize_t(n,ctx);
+}
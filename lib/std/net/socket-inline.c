@@ -0,0 +1,695 @@
+/*---------------------------------------------------------------------------
+  Copyright 2021, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+
+/* Non-blocking sockets and a poller for the event loop in `socket.kk`.
+   All sockets are created non-blocking; an operation that would block
+   returns the `EAGAIN` error and the event loop retries it once the
+   socket is ready. The poller uses `epoll` on Linux and `poll` otherwise.
+
+   Strings are written as qutf8 (raw code points from invalid UTF-8 input are
+   written as the original bytes) so binary data read from a socket is written
+   back unchanged.
+*/
+
+#if defined(_WIN32) || defined(__wasi__) || defined(__EMSCRIPTEN__)
+#define KK_NET_NONE  1
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#define KK_NET_EPOLL 1
+#endif
+#if defined(MSG_NOSIGNAL)
+#define KK_NET_NOSIGNAL  MSG_NOSIGNAL
+#else
+#define KK_NET_NOSIGNAL  0
+#endif
+#endif
+
+#define KK_NET_READABLE  (1)
+#define KK_NET_WRITABLE  (2)
+
+static kk_std_core__error kk_net_error( int err, kk_context_t* ctx ) {
+  #if !defined(KK_NET_NONE)
+  if (err == EWOULDBLOCK) err = EAGAIN;
+  #endif
+  return kk_error_from_errno(err,ctx);
+}
+
+static kk_std_core__error kk_net_ok_int( int i, kk_context_t* ctx ) {
+  return kk_error_ok(kk_integer_box(kk_integer_from_int(i,ctx)),ctx);
+}
+
+static kk_std_core__error kk_net_ok_unit( kk_context_t* ctx ) {
+  return kk_error_ok(kk_unit_box(kk_Unit),ctx);
+}
+
+
+// The total number of bytes in a vector of strings when written (to track partial writes)
+static kk_integer_t kk_net_byte_count( kk_vector_t v, kk_context_t* ctx ) {
+  kk_ssize_t len;
+  kk_box_t* elems = kk_vector_buf_borrow(v, &len);
+  kk_ssize_t total = 0;
+  for (kk_ssize_t i = 0; i < len; i++) {
+    kk_ssize_t slen;
+    bool should_free;
+    const char* buf = kk_string_to_qutf8n_borrow(kk_string_unbox(elems[i]), &slen, &should_free, ctx);
+    if (should_free) kk_free(buf,ctx);
+    total += slen;
+  }
+  kk_vector_drop(v,ctx);
+  return kk_integer_from_ssize_t(total,ctx);
+}
+
+#if defined(KK_NET_NONE)
+
+static kk_std_core__error kk_net_tcp_listen( kk_string_t host, kk_integer_t port, kk_integer_t backlog, bool reuse_port, kk_context_t* ctx ) {
+  kk_string_drop(host,ctx); kk_integer_drop(port,ctx); kk_integer_drop(backlog,ctx); kk_unused(reuse_port);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_tcp_connect( kk_string_t host, kk_integer_t port, kk_context_t* ctx ) {
+  kk_string_drop(host,ctx); kk_integer_drop(port,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_udp_bind( kk_string_t host, kk_integer_t port, kk_context_t* ctx ) {
+  kk_string_drop(host,ctx); kk_integer_drop(port,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_connect_result( kk_integer_t fd, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_accept( kk_integer_t fd, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_read( kk_integer_t fd, kk_integer_t max, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx); kk_integer_drop(max,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_read_raw( kk_integer_t fd, kk_integer_t max, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx); kk_integer_drop(max,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_writev( kk_integer_t fd, kk_vector_t v, kk_integer_t offset, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx); kk_vector_drop(v,ctx); kk_integer_drop(offset,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_send_to( kk_integer_t fd, kk_string_t msg, kk_string_t host, kk_integer_t port, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx); kk_string_drop(msg,ctx); kk_string_drop(host,ctx); kk_integer_drop(port,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_recv_from( kk_integer_t fd, kk_integer_t max, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx); kk_integer_drop(max,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_shutdown_write( kk_integer_t fd, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_close( kk_integer_t fd, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_local_port( kk_integer_t fd, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_file_open( kk_string_t path, kk_context_t* ctx ) {
+  kk_string_drop(path,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_file_size( kk_integer_t fd, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_sendfile( kk_integer_t fd, kk_integer_t file, kk_integer_t offset, kk_integer_t count, kk_context_t* ctx ) {
+  kk_integer_drop(fd,ctx); kk_integer_drop(file,ctx); kk_integer_drop(offset,ctx); kk_integer_drop(count,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_poller_create( kk_context_t* ctx ) {
+  return kk_net_error(ENOSYS,ctx);
+}
+
+static kk_std_core__error kk_net_poller_wait( kk_integer_t ep, kk_vector_t interests, kk_integer_t timeout, kk_context_t* ctx ) {
+  kk_integer_drop(ep,ctx); kk_vector_drop(interests,ctx); kk_integer_drop(timeout,ctx);
+  return kk_net_error(ENOSYS,ctx);
+}
+
+#else
+
+/*--------------------------------------------------------------------------------------
+  Socket state
+  Each thread keeps a small state per socket, indexed by the file descriptor, with
+  the bytes of an incomplete UTF-8 sequence at the end of the last read, and the
+  interests that are armed in the poller. A socket is used by the event loop of
+  one thread; the state is reset whenever a descriptor is created or closed.
+--------------------------------------------------------------------------------------*/
+
+typedef struct kk_net_fd_s {
+  uint32_t stamp;     // the wait in which `want`, `fired`, and `index` are valid
+  int32_t  poller;    // the epoll instance + 1 the socket is registered with (or 0)
+  int32_t  index;     // index in the `poll` array during a wait
+  uint8_t  armed;     // the interests armed in the poller (0 once an event fired)
+  uint8_t  want;      // the interests of the current wait
+  uint8_t  fired;     // the ready mask of the current wait
+  uint8_t  tail_len;  // incomplete UTF-8 sequence at the end of the last read
+  uint8_t  tail[4];
+} kk_net_fd_t;
+
+static kk_decl_thread kk_net_fd_t* kk_net_fds;
+static kk_decl_thread int          kk_net_fds_count;
+static kk_decl_thread uint32_t     kk_net_wait_stamp;
+
+// Returns NULL if the state cannot be allocated
+static kk_net_fd_t* kk_net_fd_state( int fd ) {
+  if (fd < 0) return NULL;
+  if (fd >= kk_net_fds_count) {
+    int count = (kk_net_fds_count == 0 ? 64 : kk_net_fds_count);
+    while (count <= fd) { count *= 2; }
+    kk_net_fd_t* fds = (kk_net_fd_t*)realloc(kk_net_fds, (size_t)count * sizeof(kk_net_fd_t));
+    if (fds == NULL) return NULL;
+    memset(fds + kk_net_fds_count, 0, (size_t)(count - kk_net_fds_count) * sizeof(kk_net_fd_t));
+    kk_net_fds = fds;
+    kk_net_fds_count = count;
+  }
+  return &kk_net_fds[fd];
+}
+
+static void kk_net_fd_reset( int fd ) {
+  if (fd >= 0 && fd < kk_net_fds_count) {
+    memset(&kk_net_fds[fd], 0, sizeof(kk_net_fd_t));
+  }
+}
+
+static kk_std_core__error kk_net_ok_fd( int fd, kk_context_t* ctx ) {
+  kk_net_fd_reset(fd);
+  return kk_net_ok_int(fd,ctx);
+}
+
+
+/*--------------------------------------------------------------------------------------
+  Addresses and socket creation
+--------------------------------------------------------------------------------------*/
+
+static int kk_net_resolve( kk_string_t host, kk_integer_t port, int socktype, bool passive,
+                           struct sockaddr_storage* addr, socklen_t* addrlen, kk_context_t* ctx ) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = socktype;
+  hints.ai_flags    = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+  char service[16];
+  snprintf(service, sizeof(service), "%d", (int)kk_integer_clamp32(port,ctx));
+  const char* chost = kk_string_cbuf_borrow(host,NULL);
+  struct addrinfo* res = NULL;
+  const int rc = getaddrinfo((chost[0]==0 ? NULL : chost), service, &hints, &res);
+  kk_string_drop(host,ctx);
+  if (rc != 0 || res == NULL) {
+    return (rc == EAI_SYSTEM ? errno : EADDRNOTAVAIL);
+  }
+  memcpy(addr, res->ai_addr, res->ai_addrlen);
+  *addrlen = res->ai_addrlen;
+  freeaddrinfo(res);
+  return 0;
+}
+
+static int kk_net_socket( int family, int socktype, int* fd ) {
+  #if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+  *fd = socket(family, socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (*fd < 0) return errno;
+  #else
+  *fd = socket(family, socktype, 0);
+  if (*fd < 0) return errno;
+  if (fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL, 0) | O_NONBLOCK) != 0 ||
+      fcntl(*fd, F_SETFD, FD_CLOEXEC) != 0) {
+    const int err = errno;
+    close(*fd);
+    return err;
+  }
+  #endif
+  #if defined(SO_NOSIGPIPE)
+  const int one = 1;
+  setsockopt(*fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+  #endif
+  return 0;
+}
+
+static kk_std_core__error kk_net_open_bound( kk_string_t host, kk_integer_t port, int socktype, int backlog, bool reuse_port, kk_context_t* ctx ) {
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  int err = kk_net_resolve(host, port, socktype, true, &addr, &addrlen, ctx);
+  if (err != 0) return kk_net_error(err,ctx);
+  int fd;
+  err = kk_net_socket(addr.ss_family, socktype, &fd);
+  if (err != 0) return kk_net_error(err,ctx);
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (reuse_port) {
+    #if defined(SO_REUSEPORT)
+    // let multiple processes listen on the same port; the kernel balances the connections
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) err = errno;
+    #else
+    err = ENOTSUP;
+    #endif
+    if (err != 0) {
+      close(fd);
+      return kk_net_error(err,ctx);
+    }
+  }
+  if (bind(fd, (struct sockaddr*)&addr, addrlen) != 0 ||
+      (socktype == SOCK_STREAM && listen(fd, backlog) != 0)) {
+    err = errno;
+    close(fd);
+    return kk_net_error(err,ctx);
+  }
+  return kk_net_ok_fd(fd,ctx);
+}
+
+static kk_std_core__error kk_net_tcp_listen( kk_string_t host, kk_integer_t port, kk_integer_t backlog, bool reuse_port, kk_context_t* ctx ) {
+  return kk_net_open_bound(host, port, SOCK_STREAM, kk_integer_clamp32(backlog,ctx), reuse_port, ctx);
+}
+
+static kk_std_core__error kk_net_udp_bind( kk_string_t host, kk_integer_t port, kk_context_t* ctx ) {
+  return kk_net_open_bound(host, port, SOCK_DGRAM, 0, false, ctx);
+}
+
+// Start connecting; the connection is established once the socket is writable (see `kk_net_connect_result`)
+static kk_std_core__error kk_net_tcp_connect( kk_string_t host, kk_integer_t port, kk_context_t* ctx ) {
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  int err = kk_net_resolve(host, port, SOCK_STREAM, false, &addr, &addrlen, ctx);
+  if (err != 0) return kk_net_error(err,ctx);
+  int fd;
+  err = kk_net_socket(addr.ss_family, SOCK_STREAM, &fd);
+  if (err != 0) return kk_net_error(err,ctx);
+  if (connect(fd, (struct sockaddr*)&addr, addrlen) != 0 && errno != EINPROGRESS) {
+    err = errno;
+    close(fd);
+    return kk_net_error(err,ctx);
+  }
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return kk_net_ok_fd(fd,ctx);
+}
+
+static kk_std_core__error kk_net_connect_result( kk_integer_t fd, kk_context_t* ctx ) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(kk_integer_clamp32(fd,ctx), SOL_SOCKET, SO_ERROR, &err, &len) != 0) err = errno;
+  if (err != 0) return kk_net_error(err,ctx);
+  return kk_net_ok_unit(ctx);
+}
+
+static kk_std_core__error kk_net_accept( kk_integer_t fd, kk_context_t* ctx ) {
+  #if defined(__linux__)
+  const int cfd = accept4(kk_integer_clamp32(fd,ctx), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (cfd < 0) return kk_net_error(errno,ctx);
+  #else
+  const int cfd = accept(kk_integer_clamp32(fd,ctx), NULL, NULL);
+  if (cfd < 0) return kk_net_error(errno,ctx);
+  fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(cfd, F_SETFD, FD_CLOEXEC);
+  #if defined(SO_NOSIGPIPE)
+  const int nosigpipe = 1;
+  setsockopt(cfd, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+  #endif
+  #endif
+  const int one = 1;
+  setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return kk_net_ok_fd(cfd,ctx);
+}
+
+static kk_std_core__error kk_net_shutdown_write( kk_integer_t fd, kk_context_t* ctx ) {
+  if (shutdown(kk_integer_clamp32(fd,ctx), SHUT_WR) != 0) return kk_net_error(errno,ctx);
+  return kk_net_ok_unit(ctx);
+}
+
+static kk_std_core__error kk_net_close( kk_integer_t fd, kk_context_t* ctx ) {
+  const int cfd = kk_integer_clamp32(fd,ctx);
+  kk_net_fd_reset(cfd);   // closing also removes the socket from any epoll instance
+  if (close(cfd) != 0) return kk_net_error(errno,ctx);
+  return kk_net_ok_unit(ctx);
+}
+
+static kk_std_core__error kk_net_local_port( kk_integer_t fd, kk_context_t* ctx ) {
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(kk_integer_clamp32(fd,ctx), (struct sockaddr*)&addr, &addrlen) != 0) return kk_net_error(errno,ctx);
+  const int port = (addr.ss_family == AF_INET6 ? ntohs(((struct sockaddr_in6*)&addr)->sin6_port)
+                                               : ntohs(((struct sockaddr_in*)&addr)->sin_port));
+  return kk_net_ok_int(port,ctx);
+}
+
+
+/*--------------------------------------------------------------------------------------
+  Reading and writing
+--------------------------------------------------------------------------------------*/
+
+#define KK_NET_MAX_READ  (64*1024)
+
+// The length of an incomplete (but so far valid) UTF-8 sequence at the end of `buf`
+static kk_ssize_t kk_net_utf8_incomplete( const uint8_t* buf, kk_ssize_t len ) {
+  kk_ssize_t i = len;
+  while (i > 0 && len - i < 3 && (buf[i-1] & 0xC0) == 0x80) { i--; }  // skip continuation bytes
+  if (i == 0) return 0;
+  const uint8_t b = buf[i-1];
+  const kk_ssize_t need = (b >= 0xC2 && b <= 0xDF ? 2 : (b >= 0xE0 && b <= 0xEF ? 3 : (b >= 0xF0 && b <= 0xF4 ? 4 : 0)));
+  const kk_ssize_t have = len - i + 1;
+  return (have < need ? have : 0);
+}
+
+// Read at most `max` bytes; returns the empty string at the end of the stream.
+// An incomplete UTF-8 sequence at the end is kept (if `hold`) and prepended to the next
+// read so a character split over two reads is decoded correctly.
+static kk_std_core__error kk_net_read_ex( kk_integer_t fd, kk_integer_t max, bool hold, kk_context_t* ctx ) {
+  int32_t n = kk_integer_clamp32(max,ctx);
+  if (n <= 0 || n > KK_NET_MAX_READ) n = KK_NET_MAX_READ;
+  const int rfd = kk_integer_clamp32(fd,ctx);
+  kk_net_fd_t* st = kk_net_fd_state(rfd);
+  if (st == NULL) return kk_net_error(ENOMEM,ctx);
+  uint8_t buf[KK_NET_MAX_READ + 4];
+  const kk_ssize_t pre = st->tail_len;
+  memcpy(buf, st->tail, (size_t)pre);
+  const ssize_t count = recv(rfd, buf + pre, (size_t)n, 0);
+  if (count < 0) return kk_net_error(errno,ctx);
+  const kk_ssize_t total = pre + count;
+  buf[total] = 0;  // so decoding never reads past the received bytes
+  // at the end of the stream an incomplete sequence is decoded as raw bytes
+  const kk_ssize_t keep = (count == 0 || !hold ? 0 : kk_net_utf8_incomplete(buf, total));
+  st->tail_len = (uint8_t)keep;
+  memcpy(st->tail, buf + total - keep, (size_t)keep);
+  if (total == keep && count > 0) return kk_net_error(EAGAIN,ctx);  // only part of a character was received
+  kk_string_t s = (total == 0 ? kk_string_empty() : kk_string_alloc_from_qutf8n(total - keep, (const char*)buf, ctx));
+  return kk_error_ok(kk_string_box(s),ctx);
+}
+
+static kk_std_core__error kk_net_read( kk_integer_t fd, kk_integer_t max, kk_context_t* ctx ) {
+  return kk_net_read_ex(fd, max, true, ctx);
+}
+
+// Read without holding back an incomplete UTF-8 sequence: writing the result gives back exactly the bytes read.
+static kk_std_core__error kk_net_read_raw( kk_integer_t fd, kk_integer_t max, kk_context_t* ctx ) {
+  return kk_net_read_ex(fd, max, false, ctx);
+}
+
+#define KK_NET_MAX_IOV  (64)
+
+// Write the strings in `v` with a single `sendmsg` (vectored), skipping the first `offset` bytes
+// that were already written. Returns the new offset.
+static kk_std_core__error kk_net_writev( kk_integer_t fd, kk_vector_t v, kk_integer_t offset, kk_context_t* ctx ) {
+  kk_ssize_t len;
+  kk_box_t* elems = kk_vector_buf_borrow(v, &len);
+  kk_ssize_t skip = kk_integer_clamp_ssize_t(offset,ctx);
+  const kk_ssize_t start = skip;
+  struct iovec iov[KK_NET_MAX_IOV];
+  const char* owned[KK_NET_MAX_IOV];  // converted strings that need to be freed
+  int iovcnt = 0;
+  int ownedcnt = 0;
+  for (kk_ssize_t i = 0; i < len && iovcnt < KK_NET_MAX_IOV; i++) {
+    kk_ssize_t slen;
+    bool should_free;
+    const char* s = kk_string_to_qutf8n_borrow(kk_string_unbox(elems[i]), &slen, &should_free, ctx);
+    if (skip >= slen) {
+      skip -= slen;
+      if (should_free) kk_free(s,ctx);
+      continue;
+    }
+    if (should_free) { owned[ownedcnt++] = s; }
+    iov[iovcnt].iov_base = (void*)(s + skip);
+    iov[iovcnt].iov_len  = (size_t)(slen - skip);
+    iovcnt++;
+    skip = 0;
+  }
+  ssize_t count = 0;
+  if (iovcnt > 0) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+    count = sendmsg(kk_integer_clamp32(fd,ctx), &msg, KK_NET_NOSIGNAL);
+  }
+  else {
+    kk_integer_drop(fd,ctx);
+  }
+  const int err = errno;
+  for (int i = 0; i < ownedcnt; i++) { kk_free(owned[i],ctx); }
+  kk_vector_drop(v,ctx);
+  if (count < 0) return kk_net_error(err,ctx);
+  return kk_error_ok(kk_integer_box(kk_integer_from_ssize_t(start + count,ctx)),ctx);
+}
+
+static kk_std_core__error kk_net_send_to( kk_integer_t fd, kk_string_t msg, kk_string_t host, kk_integer_t port, kk_context_t* ctx ) {
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  const int err = kk_net_resolve(host, port, SOCK_DGRAM, false, &addr, &addrlen, ctx);
+  if (err != 0) {
+    kk_integer_drop(fd,ctx);
+    kk_string_drop(msg,ctx);
+    return kk_net_error(err,ctx);
+  }
+  kk_ssize_t len;
+  bool should_free;
+  const char* buf = kk_string_to_qutf8n_borrow(msg, &len, &should_free, ctx);
+  const ssize_t count = sendto(kk_integer_clamp32(fd,ctx), buf, (size_t)len, KK_NET_NOSIGNAL, (struct sockaddr*)&addr, addrlen);
+  const int serr = errno;
+  if (should_free) kk_free(buf,ctx);
+  kk_string_drop(msg,ctx);
+  if (count < 0) return kk_net_error(serr,ctx);
+  return kk_net_ok_int((int)count,ctx);
+}
+
+// Receive a datagram as a tuple `(message,(host,port))`. Each datagram is decoded on its
+// own; invalid UTF-8 is kept as raw code points so `kk_net_send_to` sends the same bytes.
+static kk_std_core__error kk_net_recv_from( kk_integer_t fd, kk_integer_t max, kk_context_t* ctx ) {
+  int32_t n = kk_integer_clamp32(max,ctx);
+  if (n <= 0 || n > KK_NET_MAX_READ) n = KK_NET_MAX_READ;
+  char buf[KK_NET_MAX_READ + 1];
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+  const ssize_t count = recvfrom(kk_integer_clamp32(fd,ctx), buf, (size_t)n, 0, (struct sockaddr*)&addr, &addrlen);
+  if (count < 0) return kk_net_error(errno,ctx);
+  buf[count] = 0;
+  char host[INET6_ADDRSTRLEN+1];
+  int port;
+  if (addr.ss_family == AF_INET6) {
+    const struct sockaddr_in6* a6 = (const struct sockaddr_in6*)&addr;
+    inet_ntop(AF_INET6, &a6->sin6_addr, host, sizeof(host));
+    port = ntohs(a6->sin6_port);
+  }
+  else {
+    const struct sockaddr_in* a4 = (const struct sockaddr_in*)&addr;
+    inet_ntop(AF_INET, &a4->sin_addr, host, sizeof(host));
+    port = ntohs(a4->sin_port);
+  }
+  host[INET6_ADDRSTRLEN] = 0;
+  kk_string_t msg = (count == 0 ? kk_string_empty() : kk_string_alloc_from_qutf8n(count, buf, ctx));
+  kk_std_core_types__tuple2_ from = kk_std_core_types__new_dash__lp__comma__rp_(
+                                      kk_string_box(kk_string_alloc_dup_valid_utf8(host,ctx)),
+                                      kk_integer_box(kk_integer_from_int(port,ctx)), ctx);
+  kk_std_core_types__tuple2_ res  = kk_std_core_types__new_dash__lp__comma__rp_(
+                                      kk_string_box(msg), kk_std_core_types__tuple2__box(from,ctx), ctx);
+  return kk_error_ok(kk_std_core_types__tuple2__box(res,ctx),ctx);
+}
+
+
+/*--------------------------------------------------------------------------------------
+  Sending files
+--------------------------------------------------------------------------------------*/
+
+static kk_std_core__error kk_net_file_open( kk_string_t path, kk_context_t* ctx ) {
+  const int fd = open(kk_string_cbuf_borrow(path,NULL), O_RDONLY | O_CLOEXEC);
+  const int err = errno;
+  kk_string_drop(path,ctx);
+  if (fd < 0) return kk_net_error(err,ctx);
+  return kk_net_ok_int(fd,ctx);
+}
+
+static kk_std_core__error kk_net_file_size( kk_integer_t fd, kk_context_t* ctx ) {
+  struct stat st;
+  if (fstat(kk_integer_clamp32(fd,ctx), &st) != 0) return kk_net_error(errno,ctx);
+  return kk_error_ok(kk_integer_box(kk_integer_from_int64((int64_t)st.st_size,ctx)),ctx);
+}
+
+// Send at most `count` bytes of `file` starting at `offset`; returns the new offset.
+static kk_std_core__error kk_net_sendfile( kk_integer_t fd, kk_integer_t file, kk_integer_t offset, kk_integer_t count, kk_context_t* ctx ) {
+  const int sfd = kk_integer_clamp32(fd,ctx);
+  const int ffd = kk_integer_clamp32(file,ctx);
+  off_t off = (off_t)kk_integer_clamp64(offset,ctx);
+  const int64_t n = kk_integer_clamp64(count,ctx);
+  #if defined(__linux__)
+  // copy directly from the page cache to the socket
+  const ssize_t sent = sendfile(sfd, ffd, &off, (size_t)(n > 0x7FFFF000 ? 0x7FFFF000 : n));
+  if (sent < 0) return kk_net_error(errno,ctx);
+  if (sent == 0) return kk_net_error(EIO,ctx);   // file was truncated
+  #else
+  char buf[KK_NET_MAX_READ];
+  const ssize_t nread = pread(ffd, buf, (size_t)(n > KK_NET_MAX_READ ? KK_NET_MAX_READ : n), off);
+  if (nread < 0) return kk_net_error(errno,ctx);
+  if (nread == 0) return kk_net_error(EIO,ctx);  // file was truncated
+  const ssize_t sent = send(sfd, buf, (size_t)nread, KK_NET_NOSIGNAL);
+  if (sent < 0) return kk_net_error(errno,ctx);
+  off += sent;
+  #endif
+  return kk_error_ok(kk_integer_box(kk_integer_from_int64((int64_t)off,ctx)),ctx);
+}
+
+
+/*--------------------------------------------------------------------------------------
+  Poller
+  Each interest is encoded as `4*fd + mask` where the mask is `KK_NET_READABLE`
+  and/or `KK_NET_WRITABLE`. A wait returns a vector with, for each interest, the
+  part of its mask that is ready (or 0). A socket may occur in several interests;
+  their masks are combined per socket.
+--------------------------------------------------------------------------------------*/
+
+static kk_std_core__error kk_net_poller_create( kk_context_t* ctx ) {
+  #if defined(KK_NET_EPOLL)
+  const int ep = epoll_create1(EPOLL_CLOEXEC);
+  if (ep < 0) return kk_net_error(errno,ctx);
+  return kk_net_ok_int(ep,ctx);
+  #else
+  return kk_net_ok_int(-1,ctx);  // `poll` is stateless
+  #endif
+}
+
+#define KK_NET_MAX_EVENTS  (256)
+
+static kk_std_core__error kk_net_poller_wait( kk_integer_t ep, kk_vector_t interests, kk_integer_t timeout, kk_context_t* ctx ) {
+  const int epfd = kk_integer_clamp32(ep,ctx);
+  const int tmo  = kk_integer_clamp32(timeout,ctx);
+  kk_ssize_t len;
+  kk_box_t* elems = kk_vector_buf_borrow(interests, &len);
+  uint32_t stamp = ++kk_net_wait_stamp;
+  if (stamp == 0) { stamp = ++kk_net_wait_stamp; }  // 0 is the stamp of a fresh state
+  int err = 0;
+  // combine the interests per socket
+  kk_ssize_t nfds = 0;
+  for (kk_ssize_t i = 0; i < len && err == 0; i++) {
+    const int32_t x = kk_integer_clamp32_borrow(kk_integer_unbox(elems[i]),ctx);
+    kk_net_fd_t* st = kk_net_fd_state(x / 4);
+    if (st == NULL) { err = (x < 0 ? EBADF : ENOMEM); break; }
+    if (st->stamp != stamp) {
+      st->stamp = stamp;
+      st->want  = 0;
+      st->fired = 0;
+      st->index = (int32_t)nfds++;
+    }
+    st->want |= (uint8_t)(x & (KK_NET_READABLE|KK_NET_WRITABLE));
+  }
+  #if defined(KK_NET_EPOLL)
+  // arm the sockets as one-shot so a socket only reports readiness while a strand waits on it;
+  // a socket is only (re)armed if its interests changed or an event fired since it was armed
+  for (kk_ssize_t i = 0; i < len && err == 0; i++) {
+    const int fd = kk_integer_clamp32_borrow(kk_integer_unbox(elems[i]),ctx) / 4;
+    kk_net_fd_t* st = &kk_net_fds[fd];
+    if (st->poller == epfd + 1 && st->armed == st->want) continue;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLONESHOT | ((st->want & KK_NET_READABLE) != 0 ? EPOLLIN : 0) | ((st->want & KK_NET_WRITABLE) != 0 ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    const bool added = (st->poller == epfd + 1);
+    if (epoll_ctl(epfd, (added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD), fd, &ev) != 0) {
+      if (errno != (added ? ENOENT : EEXIST) || epoll_ctl(epfd, (added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD), fd, &ev) != 0) {
+        err = errno;
+        break;
+      }
+    }
+    st->poller = epfd + 1;
+    st->armed  = st->want;
+  }
+  if (err == 0) {
+    struct epoll_event events[KK_NET_MAX_EVENTS];
+    int n;
+    do {
+      n = epoll_wait(epfd, events, KK_NET_MAX_EVENTS, tmo);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) err = errno;
+    for (int i = 0; i < n; i++) {
+      const uint32_t evs = events[i].events;
+      const bool failed  = ((evs & (EPOLLERR|EPOLLHUP)) != 0);
+      kk_net_fd_t* st = kk_net_fd_state(events[i].data.fd);
+      if (st == NULL) continue;
+      st->armed = 0;  // disarmed until it is armed again
+      if (st->stamp == stamp) {
+        st->fired = (uint8_t)(((failed || (evs & EPOLLIN) != 0) ? KK_NET_READABLE : 0) | ((failed || (evs & EPOLLOUT) != 0) ? KK_NET_WRITABLE : 0));
+      }
+    }
+  }
+  #else
+  kk_unused(epfd);
+  struct pollfd* fds = NULL;
+  if (err == 0 && nfds > 0) {
+    fds = (struct pollfd*)kk_malloc(nfds * kk_ssizeof(struct pollfd), ctx);
+    if (fds == NULL) err = ENOMEM;
+  }
+  if (err == 0) {
+    for (kk_ssize_t i = 0; i < len; i++) {
+      const int fd = kk_integer_clamp32_borrow(kk_integer_unbox(elems[i]),ctx) / 4;
+      const kk_net_fd_t* st = &kk_net_fds[fd];
+      fds[st->index].fd      = fd;
+      fds[st->index].events  = ((st->want & KK_NET_READABLE) != 0 ? POLLIN : 0) | ((st->want & KK_NET_WRITABLE) != 0 ? POLLOUT : 0);
+      fds[st->index].revents = 0;
+    }
+    int n;
+    do {
+      n = poll(fds, (nfds_t)nfds, tmo);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) err = errno;
+    for (kk_ssize_t i = 0; i < nfds && n > 0; i++) {
+      const short evs = fds[i].revents;
+      if (evs == 0) continue;
+      const bool failed = ((evs & (POLLERR|POLLHUP|POLLNVAL)) != 0);
+      kk_net_fds[fds[i].fd].fired = (uint8_t)(((failed || (evs & POLLIN) != 0) ? KK_NET_READABLE : 0) | ((failed || (evs & POLLOUT) != 0) ? KK_NET_WRITABLE : 0));
+    }
+  }
+  if (fds != NULL) kk_free(fds,ctx);
+  #endif
+  if (err != 0) {
+    kk_vector_drop(interests,ctx);
+    return kk_net_error(err,ctx);
+  }
+  kk_box_t* buf;
+  kk_vector_t res = kk_vector_alloc_uninit(len, &buf, ctx);
+  for (kk_ssize_t i = 0; i < len; i++) {
+    const int32_t x = kk_integer_clamp32_borrow(kk_integer_unbox(elems[i]),ctx);
+    buf[i] = kk_integer_box(kk_integer_from_int(kk_net_fds[x / 4].fired & (x & 3),ctx));
+  }
+  kk_vector_drop(interests,ctx);
+  return kk_error_ok(kk_vector_box(res,ctx),ctx);
+}
+
+#endif
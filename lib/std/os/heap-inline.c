@@ -0,0 +1,28 @@
+/*---------------------------------------------------------------------------
+  Copyright 2022, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+
+static kk_integer_t kk_heap_size( kk_context_t* ctx ) {
+  return kk_integer_from_size_t( kk_heap_current_size(), ctx );
+}
+
+static kk_integer_t kk_heap_thread_size( kk_context_t* ctx ) {
+  return kk_integer_from_size_t( kk_heap_context_size(ctx), ctx );
+}
+
+static kk_integer_t kk_heap_soft_limit( kk_context_t* ctx ) {
+  return kk_integer_from_int64( kk_heap_soft_limit_of(ctx), ctx );
+}
+
+static kk_unit_t kk_heap_set_soft_limit( kk_integer_t limit, kk_context_t* ctx ) {
+  kk_heap_set_soft_limit_of( kk_integer_clamp64(limit,ctx), ctx );
+  return kk_Unit;
+}
+
+static bool kk_heap_soft_limit_exceeded_prim( kk_context_t* ctx ) {
+  return kk_heap_soft_limit_exceeded(ctx);
+}
@@ -0,0 +1,41 @@
+/*---------------------------------------------------------------------------
+  Copyright 2022, Microsoft Research, Daan Leijen.
+
+  This is free software; you can redistribute it and/or modify it under the
+  terms of the Apache License, Version 2.0. A copy of the License can be
+  found in the LICENSE file at the root of this distribution.
+---------------------------------------------------------------------------*/
+
+static kk_log_level_t kk_os_log_level( kk_integer_t level, kk_context_t* ctx ) {
+  const int32_t l = kk_integer_clamp32(level,ctx);
+  return (l <= KK_LOG_FATAL ? KK_LOG_FATAL : (l >= KK_LOG_TRACE ? KK_LOG_TRACE : (kk_log_level_t)l));
+}
+
+static kk_unit_t kk_os_log_set_level( kk_integer_t level, kk_context_t* ctx ) {
+  kk_log_set_level( kk_os_log_level(level,ctx) );
+  return kk_Unit;
+}
+
+static bool kk_os_log_enabled( kk_integer_t level, kk_context_t* ctx ) {
+  return kk_log_enabled( kk_os_log_level(level,ctx) );
+}
+
+static bool kk_os_log_set_file( kk_string_t path, kk_context_t* ctx ) {
+  const bool ok = kk_log_set_file( kk_string_cbuf_borrow(path,NULL) );
+  kk_string_drop(path,ctx);
+  return ok;
+}
+
+static kk_unit_t kk_os_log_event( kk_integer_t level, kk_string_t event, kk_string_t fields, kk_context_t* ctx ) {
+  const char* fs = kk_string_cbuf_borrow(fields,NULL);
+  kk_log_event( kk_os_log_level(level,ctx), kk_string_cbuf_borrow(event,NULL), (fs[0] == 0 ? NULL : "%s"), fs );
+  kk_string_drop(event,ctx);
+  kk_string_drop(fields,ctx);
+  return kk_Unit;
+}
+
+static kk_unit_t kk_os_log_flush( kk_context_t* ctx ) {
+  kk_unused(ctx);
+  kk_log_flush();
+  return kk_Unit;
+}
@@ -13,7 +13,7 @@ import Platform.Config(version)
 import Lib.Trace
 import Control.Applicative hiding (empty)
 import Control.Monad
-import Data.List ( intersperse, partition, sortOn )
+import Data.List ( intersperse, partition, sortOn, find )
 import Data.Char
 -- import Data.Maybe
 -- import Data.Monoid ( mappend )
@@ -40,12 +40,14 @@ import Common.Syntax
 import Core.Core
 import Core.Pretty
 import Core.CoreVar
-import Core.Borrowed ( Borrowed, borrowedExtendICore )
+import Core.Borrowed ( Borrowed, borrowedExtendICore, borrowedExtends )
 
 import Backend.C.Parc
 import Backend.C.ParcReuse
 import Backend.C.ParcReuseSpec
 import Backend.C.Box
+import Backend.C.IntRange
+import Backend.C.LoopInvariant
 
 type CommentDoc   = Doc
 type ConditionDoc = Doc
@@ -83,9 +85,10 @@ contextParam = text "kk_context_t* _ctx"
 
 genModule :: CTarget -> BuildType -> FilePath -> Pretty.Env -> Platform -> Newtypes -> Borrowed -> Bool -> Bool -> Bool -> Bool -> Int -> Maybe (Name,Bool) -> Core -> Asm Core
 genModule ctarget buildType sourceDir penv platform newtypes borrowed0 enableReuse enableSpecialize enableReuseSpecialize enableBorrowInference stackSize mbMain core0
-  =  do core <- liftUnique (do bcore <- boxCore core0            -- box/unbox transform
-                               let borrowed = borrowedExtendICore bcore borrowed0
-                               pcore <- parcCore penv platform newtypes borrowed enableSpecialize bcore -- precise automatic reference counting
+  =  do core <- liftUnique (do let lcore = loopInvariantCore (borrowedExtendICore core0 borrowed0) core0  -- borrow loop invariant parameters
+                               bcore <- boxCore (intRangeCore lcore)  -- native int loops and box/unbox transform
+                               let borrowed = borrowedExtends intRangeBorrowDefs (borrowedExtendICore bcore borrowed0)
+                               pcore <- parcCore penv platform newtypes borrowed enableSpecialize enableBorrowInference bcore -- precise automatic reference counting
                                rcore <- parcReuseCore penv enableReuse platform newtypes pcore -- constructor reuse analysis
                                if enableReuse && enableReuseSpecialize
                                   then parcReuseSpecialize penv newtypes rcore -- selective reuse
@@ -222,13 +225,22 @@ genMain :: Name -> Platform -> Int -> Maybe (Name,Bool) -> Asm ()
 genMain progName platform stackSize Nothing = return ()
 genMain progName platform stackSize (Just (name,_))
   = emitToC $
+    text "\n#if defined(KK_REPL_ENTRY)" <->
+    text "// entry for the persistent interactive host (see `kklib/src/replhost.c`)" <->
+    text "kk_decl_export void kk_repl_entry(kk_context_t* _ctx)" <+> block (vcat [
+            ppName (qualify progName (newName ".init")) <.> parens (text "_ctx") <.> semi
+          , ppName name <.> parens (text "_ctx") <.> semi
+          ])
+    <->
+    text "#else"
+    <->
     text "\n// main exit\nstatic void _kk_main_exit(void)" <+> block (vcat [
             text "kk_context_t* _ctx = kk_get_context();",
             ppName (qualify progName (newName ".done")) <.> parens (text "_ctx") <.> semi
           ])
     <->
     text "\n// main entry\nint main(int argc, char** argv)" <+> block (vcat [
-        text $ "kk_assert(sizeof(size_t)==" ++ show (sizeSize platform) ++ " && sizeof(void*)==" ++ show (sizePtr platform) ++ ");"
+        text $ "kk_assert(sizeof(size_t)==" ++ show (sizeSize platform) ++ " && sizeof(void*)==" ++ show (sizePtr platform) ++ " && sizeof(kk_box_t)==" ++ show (sizeField platform) ++ ");"
       , if stackSize == 0 then empty else
         text $ "kk_os_set_stack_size(KK_IZ(" ++ show stackSize ++ "));"
       , text "kk_context_t* _ctx = kk_main_start(argc, argv);"
@@ -239,6 +251,8 @@ genMain progName platform stackSize (Just (name,_))
       , text "kk_main_end(_ctx);"
       , text "return 0;"
       ])
+    <->
+    text "#endif"
 
 ---------------------------------------------------------------------------------
 -- Generate C statements for value definitions
@@ -356,33 +370,51 @@ genTopDefDecl genSig inlineC def@(Def name tp defBody vis sort inl rng comm)
                                        genFunDef tnames app
                         -- special case string literals
                         Lit (LitString s)
-                          -> do let (cstr,clen) = cstring s
+                          -> do platform <- getPlatform
+                                let (cstr,clen) = cstring s
                                     decl = if (isPublic vis) then empty else text "static"
-                                if (clen > 0)
-                                 then emitToC (text "kk_define_string_literal" <.> tupled [decl,ppName name,pretty clen,cstr] {- <.> semi -})
-                                 else emitToC (text "kk_define_string_literal_empty" <.> tupled [decl, ppName name])
+                                if (clen <= 0)
+                                 then emitToC (text "kk_define_string_literal_empty" <.> tupled [decl, ppName name])
+                                else if (platformHasCompressedFields platform)
+                                 -- compressed pointers are relative to the heap base which is only known at runtime
+                                 then do emitToC (text "kk_define_string_literal_init" <.> tupled [decl,ppName name,pretty clen,cstr])
+                                         emitToInit (text "kk_init_string_literal" <.> parens (ppName name) <.> semi)
+                                 else emitToC (text "kk_define_string_literal" <.> tupled [decl,ppName name,pretty clen,cstr] {- <.> semi -})
                                 when (isPublic vis) $
                                  emitToH (linebreak <.> text "extern" <+> ppType typeString <+> ppName name <.> semi)
                         -- special case for doubles
                         Lit lit@(LitFloat f)
                           -> do let flt  = ppLit lit
                                 emitToH (text "#define" <+> ppName name <+> parens (text "(double)" <.> parens flt))
-                        _ -> do doc <- genStat (ResultAssign (TName name tp) Nothing) (defBody)
-                                emitToInit (block doc)  -- must be scoped to avoid name clashes
-                                case genDupDropCall False {-drop-} tp (ppName name) of
-                                  []   -> return ()
-                                  docs -> emitToDone (hcat docs <.> semi)
-                                let hdecl = ppType tp <+> ppName name <.> semi
-                                    cdecl = ppType tp <+> ppName name <.> unitSemi tp
-                                -- if (isPublic vis) -- then do
-                                -- always public since inlined definitions can refer to it (sin16 in std/num/ddouble)
-                                emitToH (linebreak <.> text "extern" <+> hdecl)
-                                emitToC (linebreak <.> cdecl)
-                                -- else do emitToC (linebreak <.> text "static" <+> decl)
+                        _ -> do mbStatic <- genStaticValue name tp defBody
+                                case mbStatic of
+                                  Just (statics,initDoc)
+                                    -> -- constant value: statically initialized and never dropped
+                                       do mapM_ emitToC statics
+                                          emitTopValue (text " =" <+> initDoc <.> semi)
+                                  Nothing | isLazyValue defBody
+                                    -> genLazyValue name tp defBody
+                                  Nothing
+                                    -> do doc <- genStat (ResultAssign (TName name tp) Nothing) (defBody)
+                                          emitToInit (block doc)  -- must be scoped to avoid name clashes
+                                          marks <- genMarkImmortal tp (ppName name)
+                                          mapM_ (\mark -> emitToInit (mark <.> semi)) marks
+                                          case genDupDropCall False {-drop-} tp (ppName name) of
+                                            []   -> return ()
+                                            docs -> emitToDone (hcat docs <.> semi)
+                                          emitTopValue (unitSemi tp)
     in withDef name inlineC (tryFun defBody)
   where
     emit = if inlineC then emitToH else emitToC
 
+    emitTopValue :: Doc -> Asm ()
+    emitTopValue cinit
+      = do -- if (isPublic vis) -- then do
+           -- always public since inlined definitions can refer to it (sin16 in std/num/ddouble)
+           emitToH (linebreak <.> text "extern" <+> ppType tp <+> ppName name <.> semi)
+           emitToC (linebreak <.> ppType tp <+> ppName name <.> cinit)
+           -- else do emitToC (linebreak <.> text "static" <+> decl)
+
     resTp = case splitFunScheme tp of
                     Nothing -> tp
                     Just (_,_,argTps,_,resTp0) -> resTp0
@@ -407,6 +439,180 @@ genTopDefDecl genSig inlineC def@(Def name tp defBody vis sort inl rng comm)
                             <.> tblock tpDoc bodyDoc
                       )
 
+-- | Mark an initialized top-level value as immortal: it lives until the program ends
+-- and `Backend.C.Parc` omits the dup/drop on references to it (see `isImmortalType`).
+-- Value types are not marked as boxing them would allocate.
+genMarkImmortal :: Type -> Doc -> Asm [Doc]
+genMarkImmortal tp arg
+  = do newtypes <- getNewtypes
+       let markBox box = [text "kk_box_mark_immortal" <.> arguments [box]]
+       return $ case cType tp of
+         CBox      -> markBox arg
+         CFun _ _  -> markBox (genBoxCall "box" False tp arg)
+         CPrim val | val == "kk_box_t"
+                   -> markBox arg
+                   | val `elem` ["kk_integer_t","kk_string_t","kk_vector_t"]
+                   -> markBox (genBoxCall "box" False tp arg)
+         CData _   -> case dataInfoOf newtypes tp of
+                        Just info | not (dataInfoIsValue info) -> markBox (genBoxCall "box" False tp arg)
+                        _ -> []
+         _         -> []
+
+dataInfoOf :: Newtypes -> Type -> Maybe DataInfo
+dataInfoOf newtypes tp
+  = case expandSyn tp of
+      TForall _ _ t -> dataInfoOf newtypes t
+      TApp t _      -> dataInfoOf newtypes t
+      TCon tcon     -> newtypesLookupAny (typeConName tcon) newtypes
+      _             -> Nothing
+
+-- | A constant top-level value, i.e. a constructor tree over small integers, characters
+-- and singletons, is emitted as pre-initialized static data with a static header (like
+-- string literals). Such value is never allocated at initialization nor dropped at the end,
+-- and its stuck reference count makes it immortal as well (see `genMarkImmortal`).
+-- Returns the static constructor definitions (in dependency order) and the initializer
+-- of the top-level value itself.
+genStaticValue :: Name -> Type -> Expr -> Asm (Maybe ([Doc],Doc))
+genStaticValue name tp expr
+  = do newtypes <- getNewtypes
+       platform <- getPlatform
+       return $ case cType tp of
+         _ | platformHasCompressedFields platform -> Nothing  -- compressed pointers cannot be initialized statically
+         CData _ -> case staticExpr newtypes platform 1 (stripTypes expr) of
+                      Just (_,statics,val@(StaticCon _ _)) -> do initDoc <- ppStaticField val
+                                                                 return (statics,initDoc)
+                      _ -> Nothing
+         _       -> Nothing
+  where
+    stripTypes (TypeLam _ e) = stripTypes e
+    stripTypes e             = e
+
+    staticName :: Int -> Doc
+    staticName i = text "_static_" <.> ppName name <.> text "_" <.> pretty i
+
+    staticExpr :: Newtypes -> Platform -> Int -> Expr -> Maybe (Int,[Doc],StaticVal)
+    staticExpr newtypes platform n expr
+      = case expr of
+          TypeApp e _     -> staticExpr newtypes platform n e
+          Lit (LitInt i)  | isSmallInt i -> Just (n,[],StaticInt i)
+          Lit (LitChar c) -> Just (n,[],StaticChar c)
+          Con tname repr@ConSingleton{} | isStaticDataRepr (conDataRepr repr)
+            -> do (_,con) <- lookupCon tname repr
+                  return (n,[],StaticTag (ppConTag con repr (conDataRepr repr)))
+          App (TypeApp f _) args
+            -> staticExpr newtypes platform n (App f args)
+          App (Var tname (InfoExternal _)) [arg] | getName tname == nameBox
+            -> do (n1,statics,val) <- staticExpr newtypes platform n arg
+                  boxDoc <- ppStaticBox val
+                  return (n1,statics,StaticBox boxDoc)
+          App (Con tname repr) args | isStaticConRepr repr
+            -> do (_,con) <- lookupCon tname repr
+                  let params = conInfoParams con
+                      (fields,_,scanCount) = orderConFieldsEx platform newtypes False params
+                  guard (length args == length params)
+                  (n1,statics,fieldVals) <- staticArgs n (zip (map fst params) args)
+                  fieldDocs <- mapM (\(fname,_) -> do val <- lookup fname fieldVals
+                                                      doc <- ppStaticField val
+                                                      return (text "." <.> ppName (unqualify fname) <+> text "=" <+> doc)) fields
+                  let sname  = staticName n1
+                      header = text "{ { KK_HEADER_STATIC" <.> tupled [pretty scanCount, ppConTag con repr (conDataRepr repr)] <+> text "} }"
+                      def    = text "static struct" <+> ppName (conInfoName con) <+> sname <+> text "="
+                               <+> encloseSep (text "{ ") (text " };") (text ", ") (header : fieldDocs)
+                  return (n1+1, statics ++ [def], StaticCon sname (dataReprMayHaveSingletons (conDataRepr repr)))
+          _ -> Nothing
+      where
+        staticArgs n0 []  = Just (n0,[],[])
+        staticArgs n0 ((fname,arg):rest)
+          = do (n1,statics1,val)  <- staticExpr newtypes platform n0 arg
+               (n2,statics2,vals) <- staticArgs n1 rest
+               return (n2,statics1 ++ statics2,(fname,val):vals)
+
+        lookupCon tname repr
+          = do info <- newtypesLookupAny (conTypeName repr) newtypes
+               con  <- find (\c -> conInfoName c == getName tname) (dataInfoConstrs info)
+               return (info,con)
+
+    isStaticDataRepr dataRepr
+      = not (dataReprIsValue dataRepr) && dataRepr /= DataOpen
+
+    isStaticConRepr repr
+      = case repr of
+          ConNormal{} -> isStaticDataRepr (conDataRepr repr)
+          ConSingle{} -> isStaticDataRepr (conDataRepr repr)
+          ConAsCons{} -> isStaticDataRepr (conDataRepr repr)
+          _           -> False
+
+    ppStaticField val
+      = case val of
+          StaticInt i   -> Just (text "kk_static_smallint" <.> parens (pretty i))
+          StaticChar c  -> Just (ppLit (LitChar c))
+          StaticTag tag -> Just (text "kk_static_tag" <.> parens tag)
+          StaticCon s mayHaveSingletons
+                        -> Just (if mayHaveSingletons then text "kk_static_ptr" <.> parens s
+                                                      else text "&" <.> s <.> text "._base")
+          StaticBox doc -> Just doc
+
+    ppStaticBox val
+      = case val of
+          StaticInt i   -> Just (text "kk_static_smallint" <.> parens (pretty i))
+          StaticChar c  -> Just (text "kk_static_char_box" <.> parens (pretty (fromEnum c)))
+          StaticTag tag -> Just (text "kk_static_tag" <.> parens tag)
+          StaticCon s _ -> Just (text "kk_static_ptr" <.> parens s)
+          _             -> Nothing
+
+data StaticVal = StaticInt Integer
+               | StaticChar Char
+               | StaticTag Doc
+               | StaticCon Doc Bool  -- static constructor name, and whether its datatype may have singletons
+               | StaticBox Doc
+
+-- | Top-level values that need computation are initialized lazily on first use instead
+-- of at module initialization; this way a program only pays for the values it uses.
+-- In the header, the value name is a macro (`kk_lazy_value`) that reads the value once
+-- its state is done, and otherwise calls the (noinline) initializer. The initializer
+-- computes the value only in the first thread that enters it (`kk_lazy_value_enter`);
+-- other threads that use the value at the same time wait until it is done.
+-- Since top-level values are total, only the order in which they are computed changes.
+-- Lazy values are immortal and are not dropped at the end.
+genLazyValue :: Name -> Type -> Expr -> Asm ()
+genLazyValue name tp body
+  = do doc   <- genStat (ResultAssign (TName valueName tp) Nothing) body
+       marks <- genMarkImmortal tp (ppName valueName)
+       emitToH $ linebreak <.> vcat [
+                   text "extern" <+> ppType tp <+> ppName valueName <.> semi,
+                   text "extern _Atomic(int32_t)" <+> ppName stateName <.> semi,
+                   ppType tp <+> ppName initName <.> text "(void);",
+                   text "#define" <+> ppName name <+> text "kk_lazy_value" <.> tupled [ppName stateName, ppName valueName, ppName initName]
+                 ]
+       emitToC $ linebreak <.> vcat [
+                   ppType tp <+> ppName valueName <.> unitSemi tp,
+                   text "_Atomic(int32_t)" <+> ppName stateName <.> semi,
+                   text "kk_decl_noinline" <+> ppType tp <+> ppName initName <.> text "(void)" <+> block (vcat (
+                     [text "if" <+> parens (text "kk_lazy_value_enter" <.> parens (text "&" <.> ppName stateName)) <+> block (vcat (
+                        [text "kk_context_t* _ctx = kk_get_context();"
+                        ,block doc]  -- must be scoped to avoid name clashes
+                        ++ map (<.> semi) marks
+                        ++ [text "kk_lazy_value_leave" <.> parens (text "&" <.> ppName stateName) <.> semi]))
+                     ,text "return" <+> ppName valueName <.> semi]))
+                 ]
+  where
+    valueName = makeHiddenName "value" name
+    stateName = makeHiddenName "state" name
+    initName  = makeHiddenName "init" name
+
+-- | Literals, nullary constructors and references to other values are cheap enough to
+-- initialize eagerly. Everything else, including a constructor application that is not
+-- emitted as static data (see `genStaticValue`), is initialized lazily.
+isLazyValue :: Expr -> Bool
+isLazyValue expr
+  = case expr of
+      TypeLam _ e -> isLazyValue e
+      TypeApp e _ -> isLazyValue e
+      Lit _       -> False
+      Var _ _     -> False
+      Con _ _     -> False
+      _           -> True
+
 unitSemi :: Type -> Doc
 unitSemi tp
   = if (isTypeUnit tp) then text " = kk_Unit;" else semi
@@ -540,17 +746,18 @@ genConstructorType info dataRepr (con,conRepr,conFields,scanCount) =
        -> return () -- represented as an enum
     -- _ | null conFields && (dataRepr < DataNormal && not (isDataStructLike dataRepr))
     --   -> return ()
-    _  -> do emitToH $ ppVis (conInfoVis con) <.> text "struct" <+> ppName ((conInfoName con)) <+>
-                       block (let fields = (typeField ++ map ppConField conFields)
+    _  -> do isPtrField <- getIsPtrField
+             emitToH $ ppVis (conInfoVis con) <.> text "struct" <+> ppName ((conInfoName con)) <+>
+                       block (let fields = (typeField ++ map (ppConField isPtrField) conFields)
                               in if (null fields) then text "kk_box_t _unused;"  -- avoid empty struct
                                                   else vcat fields) <.> semi
   where
     typeField  = if (dataReprIsValue dataRepr) then []
                  else [text "struct" <+> ppName (typeClassName (dataInfoName info)) <.> text "_s" <+> text "_base;"]
 
-ppConField :: (Name,Type) -> Doc
-ppConField (name,tp)
-  = ppType tp <+> ppName (unqualify name) <.> semi
+ppConField :: (Type -> Bool) -> (Name,Type) -> Doc
+ppConField isPtrField (name,tp)
+  = (if isPtrField tp then text "kk_box_t" else ppType tp) <+> ppName (unqualify name) <.> semi
 
 genConstructor :: DataInfo -> DataRepr -> Int -> (ConInfo,ConRepr,[(Name,Type)],Int) -> Asm ()
 genConstructor info dataRepr maxScanCount (con,conRepr,conFields,scanCount)
@@ -631,6 +838,7 @@ genConstructorCreate info dataRepr con conRepr conFields scanCount maxScanCount
        -}
        when (dataRepr == DataOpen) $ emitToH $ text "extern kk_string_t" <+> conTagName con <.> semi
        let at = newHiddenName "at"
+       isPtrField <- getIsPtrField
        emitToH $
           text "static inline" <+> ppName (typeClassName (dataInfoName info)) <+> conCreateNameInfo con
           <.> ntparameters ((if (dataReprIsValue dataRepr || (null conFields) || isDataAsMaybe dataRepr) then [] else [(at,typeReuse)])
@@ -643,10 +851,11 @@ genConstructorCreate info dataRepr con conRepr conFields scanCount maxScanCount
               ConSingleton{} | not (dataReprIsValue dataRepr)-> text "return kk_datatype_from_tag" <.> parens (ppConTag con conRepr dataRepr) <.> semi
               ConIso{}
                 -> let tmp = text "_con"
-                   in vcat [ppName (typeClassName (dataInfoName info)) <+> tmp <+> text "= {" <+> ppDefName (fst (head conFields)) <+> text "};"  -- struct init
+                       (isoName,isoTp) = head conFields
+                   in vcat [ppName (typeClassName (dataInfoName info)) <+> tmp <+> text "= {" <+> fieldStore isPtrField isoTp (ppDefName isoName) <+> text "};"  -- struct init
                            ,text "return" <+> tmp <.> semi]
               _ -> let tmp = text "_con"
-                       assignField f (name,tp) = f (ppDefName name) <+> text "=" <+> ppDefName name <.> semi
+                       assignField f (name,tp) = f (ppDefName name) <+> text "=" <+> fieldStore isPtrField tp (ppDefName name) <.> semi
                    in if (dataReprIsValue dataRepr)
                     then vcat(--[ppName (typeClassName (dataInfoName info)) <+> tmp <.> semi]
                                (if (hasTagField dataRepr)
@@ -924,17 +1133,18 @@ genScanFieldTests lastIdx ((con,conRepr,conFields,scanCount),idx)
 
 genDupDropX :: Bool -> Name -> DataInfo -> DataRepr -> [(ConInfo,ConRepr,[(Name,Type)],Int)] -> Asm ()
 genDupDropX isDup name info dataRepr conInfos
-  = emitToH $
-     text "static inline"
-     <+> (if isDup then ppName name <+> ppName name <.> text "_dup" else text "void" <+> ppName name <.> text "_drop")
-     <.> (if isDup then tupled else parameters) [ppName name <+> text "_x"]
-     <+> block (vcat (dupDropTests))
+  = do isPtrField <- getIsPtrField
+       emitToH $
+         text "static inline"
+         <+> (if isDup then ppName name <+> ppName name <.> text "_dup" else text "void" <+> ppName name <.> text "_drop")
+         <.> (if isDup then tupled else parameters) [ppName name <+> text "_x"]
+         <+> block (vcat (dupDropTests isPtrField))
   where
     ret = (if isDup then [text "return _x;"] else [])
-    dupDropTests
+    dupDropTests isPtrField
       | dataRepr == DataEnum   = ret
-      | dataRepr == DataIso    = [genDupDropIso isDup (head conInfos)] ++ ret
-      | dataRepr <= DataStruct = map (genDupDropTests isDup dataRepr (length conInfos)) (zip conInfos [1..]) ++ ret
+      | dataRepr == DataIso    = [genDupDropIso isPtrField isDup (head conInfos)] ++ ret
+      | dataRepr <= DataStruct = map (genDupDropTests isPtrField isDup dataRepr (length conInfos)) (zip conInfos [1..]) ++ ret
       | otherwise = if (isDup) then [text "return"
                                       <+> (if dataReprMayHaveSingletons dataRepr
                                             then text "kk_datatype_dup(_x)"
@@ -943,15 +1153,15 @@ genDupDropX isDup name info dataRepr conInfos
                                else [text (if dataReprMayHaveSingletons dataRepr then "kk_datatype_drop" else "kk_basetype_drop")
                                        <.> arguments [text "_x"] <.> semi]
 
-genDupDropIso :: Bool -> (ConInfo,ConRepr,[(Name,Type)],Int) -> Doc
-genDupDropIso isDup (con,conRepr,[(name,tp)],scanCount)
-  = hcat $ map (<.>semi) (genDupDropCall isDup tp (text "_x." <.> ppName name))
-genDupDropIso _ _
+genDupDropIso :: (Type -> Bool) -> Bool -> (ConInfo,ConRepr,[(Name,Type)],Int) -> Doc
+genDupDropIso isPtrField isDup (con,conRepr,[(name,tp)],scanCount)
+  = hcat $ map (<.>semi) (genDupDropCall isDup tp (fieldLoad isPtrField tp (text "_x." <.> ppName name)))
+genDupDropIso _ _ _
   = failure $ "Backend.C.genDupDropIso: ivalid arguments"
 
-genDupDropTests :: Bool -> DataRepr -> Int -> ((ConInfo,ConRepr,[(Name,Type)],Int),Int) -> Doc
-genDupDropTests isDup dataRepr lastIdx ((con,conRepr,conFields,scanCount),idx)
-  = let stats = genDupDropFields isDup dataRepr con conFields
+genDupDropTests :: (Type -> Bool) -> Bool -> DataRepr -> Int -> ((ConInfo,ConRepr,[(Name,Type)],Int),Int) -> Doc
+genDupDropTests isPtrField isDup dataRepr lastIdx ((con,conRepr,conFields,scanCount),idx)
+  = let stats = genDupDropFields isPtrField isDup dataRepr con conFields
     in if (lastIdx == idx)
         then (if null stats
                then empty
@@ -961,10 +1171,10 @@ genDupDropTests isDup dataRepr lastIdx ((con,conRepr,conFields,scanCount),idx)
         else (text (if (idx==1) then "if" else "else if") <+> parens (conTestName con <.> tupled [text "_x"]))
              <+> (if null stats then text "{ }" else block (vcat stats))
 
-genDupDropFields :: Bool -> DataRepr -> ConInfo -> [(Name,Type)] -> [Doc]
-genDupDropFields isDup dataRepr con conFields
+genDupDropFields :: (Type -> Bool) -> Bool -> DataRepr -> ConInfo -> [(Name,Type)] -> [Doc]
+genDupDropFields isPtrField isDup dataRepr con conFields
   = map (\doc -> doc <.> semi) $ concat $
-    [genDupDropCall isDup tp
+    [genDupDropCall isDup tp $ fieldLoad isPtrField tp
       ((if (hasTagField dataRepr) then text "_x._cons." <.> ppDefName (conInfoName con) else text "_x")
        <.> dot <.> ppName name) | (name,tp) <- conFields]
 
@@ -1069,6 +1279,36 @@ vcatBreak []  = empty
 vcatBreak xs  = linebreak <.> vcat xs
 
 
+-- | With compressed fields (`c64c`) the runtime scans every field as a `kk_box_t` and
+-- `orderConFieldsEx` sizes scan fields by `sizeField`. Fields that are a full C pointer
+-- (functions, references, and datatypes without singletons) are therefore declared as
+-- `kk_box_t` and stored encoded (see `kk_field_ptr_store` and `kk_field_ptr_load`).
+getIsPtrField :: Asm (Type -> Bool)
+getIsPtrField
+  = do platform <- getPlatform
+       newtypes <- getNewtypes
+       return (\tp -> platformHasCompressedFields platform && isPtrType newtypes tp)
+
+isPtrType :: Newtypes -> Type -> Bool
+isPtrType newtypes tp
+  = case cType tp of
+      CFun _ _         -> True
+      CPrim "kk_ref_t" -> True
+      CData _          -> case dataInfoOf newtypes tp of
+                            Just info -> let dataRepr = fst (getDataRepr info)
+                                         in not (dataReprIsValue dataRepr || dataReprMayHaveSingletons dataRepr)
+                            Nothing   -> False
+      _                -> False
+
+fieldStore :: (Type -> Bool) -> Type -> Doc -> Doc
+fieldStore isPtrField tp doc
+  = if isPtrField tp then text "kk_field_ptr_store" <.> parens doc else doc
+
+fieldLoad :: (Type -> Bool) -> Type -> Doc -> Doc
+fieldLoad isPtrField tp doc
+  = if isPtrField tp then text "kk_field_ptr_load" <.> tupled [ppType tp, doc] else doc
+
+
 dataReprMayHaveSingletons :: DataRepr -> Bool
 dataReprMayHaveSingletons dataRepr
   = case dataRepr of
@@ -1092,11 +1332,12 @@ genLambda params eff body
            freeVars  = [(nm,tp) | (TName nm tp) <- tnamesList (freeLocals (Lam params eff body))]
        newtypes <- getNewtypes
        platform <- getPlatform
+       isPtrField <- getIsPtrField
        let (fields,_,scanCount) = orderConFieldsEx platform newtypes False freeVars
            fieldDocs = [ppType tp <+> ppName name | (name,tp) <- fields]
            tpDecl  = text "struct" <+> ppName funTpName <+> block (
                        vcat ([text "struct kk_function_s _base;"] ++
-                             [ppType tp <+> ppName name <.> semi | (name,tp) <- fields])
+                             [(if isPtrField tp then text "kk_box_t" else ppType tp) <+> ppName name <.> semi | (name,tp) <- fields])
                      ) <.> semi
 
            funSig  = text (if toH then "extern" else "static") <+> ppType (typeOf body)
@@ -1114,7 +1355,7 @@ genLambda params eff body
                          else [structDoc <.> text "* _self = kk_function_alloc_as" <.> arguments [structDoc, pretty (scanCount + 1) -- +1 for the _base.fun
                                                                                               ] <.> semi
                               ,text "_self->_base.fun = kk_cfun_ptr_box(&" <.> ppName funName <.> text ", kk_context());"]
-                              ++ [text "_self->" <.> ppName name <+> text "=" <+> ppName name <.> semi | (name,_) <- fields]
+                              ++ [text "_self->" <.> ppName name <+> text "=" <+> fieldStore isPtrField tp (ppName name) <.> semi | (name,tp) <- fields]
                               ++ [text "return &_self->_base;"])
                      )
 
@@ -1126,7 +1367,7 @@ genLambda params eff body
                       (if (null fields) then text "kk_unused(_fself);"
                         else let dups = braces (hcat [genDupCall tp (ppName name) <.> semi | (name,tp) <- fields])
                              in vcat ([structDoc <.> text "* _self = kk_function_as" <.> tupled [structDoc <.> text "*",text "_fself"] <.> semi]
-                                   ++ [ppType tp <+> ppName name <+> text "= _self->" <.> ppName name <.> semi <+> text "/*" <+> pretty tp <+> text "*/"  | (name,tp) <- fields]
+                                   ++ [ppType tp <+> ppName name <+> text "=" <+> fieldLoad isPtrField tp (text "_self->" <.> ppName name) <.> semi <+> text "/*" <+> pretty tp <+> text "*/"  | (name,tp) <- fields]
                                    ++ [text "kk_drop_match" <.> arguments [text "_self",dups,text "{}"]]
                                    ))
                       <-> bodyDoc
@@ -1450,7 +1691,7 @@ genPatternTest doTest gfree (exprDoc,pattern)
       PatVar tname pattern | hiddenNameStartsWith (getName tname) "unbox"
         -> do let after = ppType (typeOf tname) <+> ppDefName (getName tname) <+> text "="
                               <+> genBoxCall "unbox" True (typeOf tname) exprDoc <.> semi
-                  next  = genNextPatterns (\self fld -> self) (ppDefName (getName tname)) (typeOf tname) [pattern]
+                  next  = genNextPatterns (\self fld ftp -> self) (ppDefName (getName tname)) (typeOf tname) [pattern]
               return [([],[after],next)]
       -}
       {-
@@ -1458,19 +1699,19 @@ genPatternTest doTest gfree (exprDoc,pattern)
         -> do let tp    = targ
                   after = ppType tp <+> ppDefName (getName tname) <+> text "="
                           <+> genBoxCall "unbox" True tp exprDoc <.> semi
-                  next  = genNextPatterns (\self fld -> self) (ppDefName (getName tname)) tp [pattern]
+                  next  = genNextPatterns (\self fld ftp -> self) (ppDefName (getName tname)) tp [pattern]
               return [([],[after],next)]
       -}
       PatCon bname [pattern] repr [targ] exists tres info skip  | getName bname == nameBoxCon
         -> do local <- newVarName "unbox"
               let unbox   = genBoxCall "unbox" True targ exprDoc
-                  next    = genNextPatterns (\self fld -> self) {-(ppDefName local)-} unbox targ [pattern]
+                  next    = genNextPatterns (\self fld ftp -> self) {-(ppDefName local)-} unbox targ [pattern]
                   -- assign  = ppType targ <+> ppDefName local <+> text "=" <+> unbox <.> semi
               return [([],[{-assign-}],next)]
       PatVar tname pattern
         -> do let after = if (patternVarFree pattern && not (tnamesMember tname gfree)) then []
                            else [ppType (typeOf tname) <+> ppDefName (getName tname) <+> text "=" <+> exprDoc <.> semi]
-                  next  = genNextPatterns (\self fld -> self) (ppDefName (getName tname)) (typeOf tname) [pattern]
+                  next  = genNextPatterns (\self fld ftp -> self) (ppDefName (getName tname)) (typeOf tname) [pattern]
               return [([],after,next)]
       PatLit (LitString s)
         -> return [(test [text "kk_string_cmp_cstr_borrow" <.> tupled [exprDoc,fst (cstring s)] <+> text "== 0"],[],[])]
@@ -1487,7 +1728,7 @@ genPatternTest doTest gfree (exprDoc,pattern)
                     -> return [(xtest [text "!" <.> parens exprDoc],[],[])]
                  ConAsJust{} 
                     -> do let next = genNextPatterns 
-                                        (\self fld -> text "kk_datatype_unJust" <.> arguments [self]) 
+                                        (\self fld ftp -> text "kk_datatype_unJust" <.> arguments [self]) 
                                         exprDoc (typeOf tname) patterns
                           return [(xtest [conTestName info <.> parens exprDoc],[],next)]
                  _  -> let dataRepr = conDataRepr repr
@@ -1501,15 +1742,17 @@ genPatternTest doTest gfree (exprDoc,pattern)
           valTest conName conInfo dataRepr
             = --do let next = genNextPatterns (exprDoc) (typeOf tname) patterns
               --   return [(test [conTestName conInfo <.> parens exprDoc],[assign],next)]
-              do let selectOp = if (hasTagField dataRepr)
+              do isPtrField <- getIsPtrField
+                 let selectOp = if (hasTagField dataRepr)
                                  then "._cons." ++ show (ppDefName (getName conName)) ++ "."
                                  else "."
-                     next = genNextPatterns (\self fld -> self <.> text selectOp <.> fld) exprDoc (typeOf tname) patterns
+                     next = genNextPatterns (\self fld ftp -> fieldLoad isPtrField ftp (self <.> text selectOp <.> fld)) exprDoc (typeOf tname) patterns
                  return [(xtest [conTestName conInfo <.> tupled [exprDoc]],[],next)]
 
           conTest conInfo
             = do local <- newVarName "con"
-                 let next    = genNextPatterns (\self fld -> self <.> text "->" <.> fld) (ppDefName local) (typeOf tname) patterns
+                 isPtrField <- getIsPtrField
+                 let next    = genNextPatterns (\self fld ftp -> fieldLoad isPtrField ftp (self <.> text "->" <.> fld)) (ppDefName local) (typeOf tname) patterns
                      typeDoc = text "struct" <+> ppName (conInfoName conInfo) <.> text "*"
                      assign  = typeDoc <+> ppDefName local <+> text "=" <+> conAsName conInfo <.> tupled [exprDoc] <.> semi
                  return [(xtest [conTestName conInfo <.> parens exprDoc],[assign],next)]
@@ -1521,7 +1764,7 @@ patternVarFree  pat
       --PatLit (LitChar _)   -> True
       _ -> False
 
-genNextPatterns :: (Doc -> Doc -> Doc) -> Doc -> Type -> [Pattern] -> [(Doc,Pattern)]
+genNextPatterns :: (Doc -> Doc -> Type -> Doc) -> Doc -> Type -> [Pattern] -> [(Doc,Pattern)]
 genNextPatterns select exprDoc tp []
   = []
 genNextPatterns select exprDoc tp patterns
@@ -1533,17 +1776,17 @@ genNextPatterns select exprDoc tp patterns
                [pat]      | length args == 0 || length args > 1 -> [(exprDoc, pat)]
                _          -> assertion ("C.FromCore.genNextPatterns: args != patterns " ++ show (length args, length patterns) ++ show (args,patterns) ++ ":\n expr: " ++ show exprDoc ++ "\n type: " ++ show tp) (length args == length patterns) $
                              concatMap genNextPattern
-                                          (zip [if nameIsNil name then newFieldName i else name  | (name,i) <- zip (map fst args) [1..]]
+                                          (zip [(if nameIsNil name then newFieldName i else name, ftp) | ((name,ftp),i) <- zip args [1..]]
                                            patterns)
          _ -> case patterns of
                 [PatWild] -> []
                 [pat]     -> [(exprDoc,pat)]
                 _         -> failure "C.FromCore.genNextPatterns: patterns but not a function"
   where
-    genNextPattern (name,pattern)
+    genNextPattern ((name,ftp),pattern)
       = case pattern of
           PatWild -> []
-          _       -> let patDoc = select exprDoc (ppDefName name)
+          _       -> let patDoc = select exprDoc (ppDefName name) ftp
                      in [(patDoc, pattern)]
 
 
@@ -1842,10 +2085,11 @@ genAppNormal f args
 genAssignFields :: Doc -> TName -> TName -> [Name] -> [Expr] -> Asm ([Doc], Doc, [Doc], Doc)
 genAssignFields tmp conName reuseName fieldNames fieldValues
   = do (decls,fieldDocs) <- genExprs fieldValues   
+       isPtrField <- getIsPtrField
        let conTp    = text "struct" <+> ppName (getName conName) <.> text "*"
            tmpDecl  = conTp <+> tmp <+> text "=" <+> parens conTp <.> ppName (getName reuseName) <.> semi
-           assigns  = [tmp <.> text "->" <.> ppName fname <+> text "=" <+> fval <.> semi
-                     | (fname,fval) <- zip fieldNames fieldDocs]
+           assigns  = [tmp <.> text "->" <.> ppName fname <+> text "=" <+> fieldStore isPtrField (typeOf fexpr) fval <.> semi
+                     | (fname,fexpr,fval) <- zip3 fieldNames fieldValues fieldDocs]
            result   = conBaseCastName (getName conName) <.> parens tmp
        return (decls, tmpDecl, assigns, result)
 
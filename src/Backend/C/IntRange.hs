@@ -0,0 +1,379 @@
+-----------------------------------------------------------------------------
+-- Copyright 2021, Microsoft Research, Daan Leijen.
+--
+-- This is free software; you can redistribute it and/or modify it under the
+-- terms of the Apache License, Version 2.0. A copy of the License can be
+-- found in the LICENSE file at the root of this distribution.
+-----------------------------------------------------------------------------
+
+{-  Native integer loops.
+
+    An `int` is arbitrary precision, so a loop counter goes through `kk_integer_add`
+    and `kk_integer_lte_borrow` on every iteration. For a top-level function `f` that
+    tail calls itself, we use a simple range analysis to find a counter parameter `i` where:
+
+    - every tail call to `f` passes `i`, `i + c`, or `i - c` for a small constant `c`;
+    - an increment is guarded by `i <= b` or `i < b` (and a decrement by `i >= b` or `i > b`);
+    - each such bound `b` is a small constant, or an `int` parameter that is passed
+      unchanged in every tail call.
+
+    If `i` and the bound parameters are small integers on entry, `i` stays within the
+    bounds (plus `c`) during the loop and fits in a `kk_ssize_t`. We generate a specialized
+    `f.native` where these parameters are raw `kk_ssize_t`s (and that tail calls itself),
+    and `f` first checks if its arguments are small and if so continues with `f.native`.
+    Any other use of `i` in `f.native` converts back to an `int` (which is cheap for small integers).
+-}
+
+module Backend.C.IntRange ( intRangeCore, intRangeBorrowDefs ) where
+
+import Data.List( isPrefixOf, nub )
+import Data.Maybe( catMaybes )
+
+import Common.Name
+import Common.NamePrim( nameTrue, nameFalse, nameDecreasing, nameIntAdd, nameIntSub )
+import Common.Syntax
+import Type.Type
+import Core.Core
+
+--------------------------------------------------------------------------
+-- Transform top-level recursive definitions
+--------------------------------------------------------------------------
+
+intRangeCore :: Core -> Core
+intRangeCore core
+  = core{ coreProgDefs = map intRangeDefGroup (coreProgDefs core) }
+
+intRangeDefGroup :: DefGroup -> DefGroup
+intRangeDefGroup dg
+  = case dg of
+      DefRec defs -> DefRec (concatMap intRangeDef defs)
+      _           -> dg
+
+intRangeDef :: Def -> [Def]
+intRangeDef def
+  = case (defSort def, splitFunExpr (defExpr def)) of
+      (DefFun pinfos, Just (tvs,params,eff,body))
+        -> case [(k,i,bounds) | (k,i) <- zip [0..] params, isTypeInt (tnameType i), not (i `elem` invariants)
+                              , Just bounds <- [checkCounter (defName def) i k invariants body]] of
+             ((k,i,bounds):_)
+               -> -- trace ("native int loop: " ++ show (defName def) ++ ", counter: " ++ show (getName i)) $
+                  let raws    = k : [j | (j,p) <- zip [0..] params, p `elem` bounds]
+                      params' = [if (j `elem` raws) then rawTName p else p | (j,p) <- zip [0..] params]
+                      ntp     = retypeParams raws (defType def)
+                      native  = Native (defName def) nname ntp k i (rawTName i) [(b, rawTName b) | b <- bounds]
+                      nativeDef = def{ defName   = nname
+                                     , defType   = ntp
+                                     , defExpr   = addTypeLambdas tvs (Lam params' eff (nativeExpr native True body))
+                                     , defVis    = Private
+                                     , defSort   = DefFun [if (j `elem` raws) then Own else pinfo | (j,pinfo) <- zip [0..length params - 1] (pinfos ++ repeat Own)]
+                                     , defInline = InlineNever
+                                     }
+                      nativeCall = App (addTypeApps tvs (Var (TName nname ntp) (InfoArity (length tvs) (length params))))
+                                       [if (j `elem` raws) then exprToRaw (Var p InfoNone) else Var p InfoNone | (j,p) <- zip [0..] params]
+                      check      = foldr1 exprAnd [exprIsSmall (Var p InfoNone) | (j,p) <- zip [0..] params, j `elem` raws]
+                      genericDef = def{ defExpr = addTypeLambdas tvs (Lam params eff (makeIfExpr check nativeCall body)) }
+                  in [nativeDef, genericDef]
+             [] -> [def]
+        where
+          calls      = tailCalls (defName def) body
+          invariants = [p | (k,p) <- zip [0..] params, isTypeInt (tnameType p), not (null calls), all (isVarArg p k) calls]
+          nname      = makeHiddenName "native" (defName def)
+      _ -> [def]
+
+splitFunExpr :: Expr -> Maybe ([TypeVar],[TName],Effect,Expr)
+splitFunExpr expr
+  = case expr of
+      TypeLam tvs (Lam params eff body) -> Just (tvs,params,eff,body)
+      Lam params eff body               -> Just ([],params,eff,body)
+      _                                 -> Nothing
+
+-- | Change the types of the given parameters to `ssize_t`
+retypeParams :: [Int] -> Type -> Type
+retypeParams raws tp
+  = case tp of
+      TForall tvs preds rho -> TForall tvs preds (retypeParams raws rho)
+      TSyn _ _ t            -> retypeParams raws t
+      TFun pars eff res     -> TFun [(name, if (j `elem` raws) then typeSSizeT else ptp) | (j,(name,ptp)) <- zip [0..] pars] eff res
+      _                     -> tp
+
+rawTName :: TName -> TName
+rawTName tname
+  = TName (makeHiddenName "raw" (getName tname)) typeSSizeT
+
+
+--------------------------------------------------------------------------
+-- Range analysis
+--------------------------------------------------------------------------
+
+data Bound = BoundLit Integer
+           | BoundVar TName
+
+data Fact  = Upper Bound    -- counter is at most the bound
+           | Lower Bound    -- counter is at least the bound
+
+-- | The argument lists of all tail calls to `f`
+tailCalls :: Name -> Expr -> [[Expr]]
+tailCalls f expr
+  = case expr of
+      App e args   | isFunVar f e -> [args]
+      Let _ body   -> tailCalls f body
+      Case _ bs    -> concat [tailCalls f e | Branch _ gs <- bs, Guard _ e <- gs]
+      _            -> []
+
+isFunVar :: Name -> Expr -> Bool
+isFunVar f expr
+  = case expr of
+      Var tname _ -> getName tname == f
+      TypeApp e _ -> isFunVar f e
+      _           -> False
+
+isVarArg :: TName -> Int -> [Expr] -> Bool
+isVarArg p k args
+  = case drop k args of
+      (Var v _ : _) -> v == p
+      _             -> False
+
+-- | Check if parameter `i` (at position `k`) is a counter that stays within its bounds in every
+-- tail call, and return the parameters that are used as a bound.
+checkCounter :: Name -> TName -> Int -> [TName] -> Expr -> Maybe [TName]
+checkCounter f i k invariants body
+  = do steps <- check [] body
+       if (any (\(step,_) -> step /= 0) steps)
+         then return (nub (catMaybes (map snd steps)))
+         else Nothing
+  where
+    check :: [Fact] -> Expr -> Maybe [(Integer,Maybe TName)]
+    check facts expr
+      = case expr of
+          App e args | isFunVar f e
+            -> do step  <- counterStep i (drop k args)
+                  bound <- if (step == 0) then return Nothing
+                           else case [b | fact <- facts, Just b <- [factBound (step > 0) fact]] of
+                                  (b:_) -> return (boundParam b)
+                                  []    -> Nothing
+                  return [(step,bound)]
+          Let _ e
+            -> check facts e
+          Case [scrut] branches | Just (pos,neg) <- condFacts i invariants scrut
+            -> fmap concat $ sequence [check (fs ++ facts) e | (fs,Branch _ gs) <- zip (branchFacts pos neg branches) branches, Guard _ e <- gs]
+          Case _ branches
+            -> fmap concat $ sequence [check facts e | Branch _ gs <- branches, Guard _ e <- gs]
+          _ -> return []
+
+    factBound :: Bool -> Fact -> Maybe Bound
+    factBound True  (Upper b) = Just b
+    factBound False (Lower b) = Just b
+    factBound _ _             = Nothing
+
+    boundParam (BoundVar b) = Just b
+    boundParam _            = Nothing
+
+-- | The step of the counter argument in a tail call
+counterStep :: TName -> [Expr] -> Maybe Integer
+counterStep i (arg:_)
+  = case stripDecreasing arg of
+      Var v _ | v == i -> Just 0
+      App (Var op _) [Var v _, Lit (LitInt c)] | v == i && isSmallConst c && getName op == nameIntAdd -> Just c
+      App (Var op _) [Lit (LitInt c), Var v _] | v == i && isSmallConst c && getName op == nameIntAdd -> Just c
+      App (Var op _) [Var v _, Lit (LitInt c)] | v == i && isSmallConst c && getName op == nameIntSub -> Just (-c)
+      _ -> Nothing
+counterStep i [] = Nothing
+
+stripDecreasing :: Expr -> Expr
+stripDecreasing expr
+  = case expr of
+      App (TypeApp (Var v _) _) [arg] | getName v == nameDecreasing -> arg
+      App (Var v _) [arg]             | getName v == nameDecreasing -> arg
+      _ -> expr
+
+-- | Small constants fit in a `kk_ssize_t` on any platform even if added to the largest small integer.
+isSmallConst :: Integer -> Bool
+isSmallConst i
+  = (i >= -maxConst && i <= maxConst)
+  where
+    maxConst = 2^20
+
+-- | The facts about the counter `i` if the condition is true or false
+condFacts :: TName -> [TName] -> Expr -> Maybe ([Fact],[Fact])
+condFacts i invariants expr
+  = case expr of
+      App (Var _ (InfoExternal formats)) [x,y]
+        -> do cmp <- compareOp formats
+              case (x,y) of
+                (Var v _, _) | v == i -> do b <- toBound y
+                                            facts cmp b
+                (_, Var v _) | v == i -> do b <- toBound x
+                                            facts (flipCompare cmp) b
+                _ -> Nothing
+      _ -> Nothing
+  where
+    toBound (Lit (LitInt n)) | isSmallConst n = Just (BoundLit n)
+    toBound (Var v _)        | v `elem` invariants = Just (BoundVar v)
+    toBound _                = Nothing
+
+    facts cmp b
+      = case cmp of
+          "<="  -> Just ([Upper b],[Lower b])
+          "<"   -> Just ([Upper b],[Lower b])
+          ">="  -> Just ([Lower b],[Upper b])
+          ">"   -> Just ([Lower b],[Upper b])
+          _     -> Nothing
+
+-- | The facts that hold in each branch of a boolean match
+branchFacts :: [Fact] -> [Fact] -> [Branch] -> [[Fact]]
+branchFacts pos neg branches
+  = walk False False branches
+  where
+    walk seenTrue seenFalse (Branch [pat] guards : bs)
+      = let total = all (isExprTrue . guardTest) guards
+        in case pat of
+             PatCon{ patConName = c } | getName c == nameTrue  -> pos : walk (seenTrue || total) seenFalse bs
+                                      | getName c == nameFalse -> neg : walk seenTrue (seenFalse || total) bs
+             PatWild | seenTrue  -> neg : walk seenTrue seenFalse bs
+                     | seenFalse -> pos : walk seenTrue seenFalse bs
+             _ -> [] : walk seenTrue seenFalse bs
+    walk seenTrue seenFalse (_ : bs) = [] : walk seenTrue seenFalse bs
+    walk _ _ [] = []
+
+-- | Recognize integer comparisons by their C external
+compareOp :: [(Target,String)] -> Maybe String
+compareOp formats
+  = case lookupTarget (C CDefault) formats of
+      Just fmt | "kk_integer_lte_borrow(" `isPrefixOf` fmt -> Just "<="
+               | "kk_integer_lt_borrow(" `isPrefixOf` fmt  -> Just "<"
+               | "kk_integer_gte_borrow(" `isPrefixOf` fmt -> Just ">="
+               | "kk_integer_gt_borrow(" `isPrefixOf` fmt  -> Just ">"
+               | "kk_integer_eq_borrow(" `isPrefixOf` fmt  -> Just "=="
+               | "kk_integer_neq_borrow(" `isPrefixOf` fmt -> Just "!="
+      _ -> Nothing
+
+flipCompare :: String -> String
+flipCompare cmp
+  = case cmp of
+      "<="  -> ">="
+      "<"   -> ">"
+      ">="  -> "<="
+      ">"   -> "<"
+      _     -> cmp
+
+
+--------------------------------------------------------------------------
+-- Generate the native loop
+--------------------------------------------------------------------------
+
+data Native = Native{ nativeFun     :: Name
+                    , nativeName    :: Name
+                    , nativeTp      :: Type
+                    , nativeIndex   :: Int
+                    , nativeCounter :: TName
+                    , nativeRaw     :: TName
+                    , nativeBounds  :: [(TName,TName)]
+                    }
+
+nativeExpr :: Native -> Bool -> Expr -> Expr
+nativeExpr native isTail expr
+  = case expr of
+      App e args | isTail && isFunVar (nativeFun native) e
+        -> App (retarget e) [nativeArg j arg | (j,arg) <- zip [0..] args]
+      App (Var op (InfoExternal formats)) [x,y] | Just cmp <- compareOp formats, Just rx <- rawOperand x, Just ry <- rawOperand y
+        -> exprRawCompare cmp rx ry
+      App e args
+        -> App (nativeExpr native False e) (map (nativeExpr native False) args)
+      Lam params eff body
+        -> Lam params eff (nativeExpr native False body)
+      Let dgs body
+        -> Let (map nativeDefGroup dgs) (nativeExpr native isTail body)
+      Case exprs branches
+        -> Case (map (nativeExpr native False) exprs)
+                [Branch pats [Guard (nativeExpr native False test) (nativeExpr native isTail e) | Guard test e <- guards] | Branch pats guards <- branches]
+      TypeLam tvs e
+        -> TypeLam tvs (nativeExpr native False e)
+      TypeApp e tps
+        -> TypeApp (nativeExpr native False e) tps
+      Var v _ | Just raw <- rawVar v
+        -> exprFromRaw (Var raw InfoNone)
+      _ -> expr
+  where
+    nativeDefGroup dg
+      = case dg of
+          DefNonRec def -> DefNonRec (nativeDef def)
+          DefRec defs   -> DefRec (map nativeDef defs)
+    nativeDef def
+      = def{ defExpr = nativeExpr native False (defExpr def) }
+
+    retarget e
+      = case e of
+          Var _ info    -> Var (TName (nativeName native) (nativeTp native)) info
+          TypeApp e tps -> TypeApp (retarget e) tps
+          _             -> e
+
+    nativeArg j arg
+      | j == nativeIndex native
+        = case stripDecreasing arg of
+            Var _ _ -> Var (nativeRaw native) InfoNone
+            App (Var op _) [Var _ _, Lit (LitInt c)] | getName op == nameIntAdd -> exprRawAdd "+" (Var (nativeRaw native) InfoNone) (exprRawLit c)
+            App (Var op _) [Lit (LitInt c), Var _ _] | getName op == nameIntAdd -> exprRawAdd "+" (Var (nativeRaw native) InfoNone) (exprRawLit c)
+            App (Var op _) [Var _ _, Lit (LitInt c)] | getName op == nameIntSub -> exprRawAdd "-" (Var (nativeRaw native) InfoNone) (exprRawLit c)
+            _ -> nativeExpr native False arg  -- cannot happen as all tail calls were checked
+      | otherwise
+        = case arg of
+            Var v _ | Just raw <- rawVar v -> Var raw InfoNone   -- bound parameters are passed unchanged
+            _ -> nativeExpr native False arg
+
+    rawVar v
+      = if (v == nativeCounter native) then Just (nativeRaw native) else lookup v (nativeBounds native)
+
+    rawOperand e
+      = case e of
+          Var v _ | Just raw <- rawVar v        -> Just (Var raw InfoNone)
+          Lit (LitInt n) | isSmallConst n       -> Just (exprRawLit n)
+          _ -> Nothing
+
+
+--------------------------------------------------------------------------
+-- Primitive operations on raw integers
+--------------------------------------------------------------------------
+
+nameIntIsSmall, nameIntToRaw, nameIntFromRaw, nameRawOp, nameBoolAnd :: Name
+nameIntIsSmall = newHiddenName "int-is-small"
+nameIntToRaw   = newHiddenName "int-to-raw"
+nameIntFromRaw = newHiddenName "int-from-raw"
+nameRawOp      = newHiddenName "raw-op"
+nameBoolAnd    = newHiddenName "bool-and"
+
+-- | The conversions from an `int` only inspect their argument
+intRangeBorrowDefs :: [(Name,[ParamInfo])]
+intRangeBorrowDefs
+  = [(nameIntIsSmall,[Borrow]),(nameIntToRaw,[Borrow])]
+
+cexternal :: Name -> [Type] -> Type -> String -> Expr
+cexternal name argTps resTp fmt
+  = Var (TName name (typeFun [(nameNil,tp) | tp <- argTps] typeTotal resTp)) (InfoExternal [(C CDefault, fmt)])
+
+exprIsSmall :: Expr -> Expr
+exprIsSmall x
+  = App (cexternal nameIntIsSmall [typeInt] typeBool "kk_is_smallint(#1)") [x]
+
+exprAnd :: Expr -> Expr -> Expr
+exprAnd x y
+  = App (cexternal nameBoolAnd [typeBool,typeBool] typeBool "(#1 && #2)") [x,y]
+
+exprToRaw :: Expr -> Expr
+exprToRaw x
+  = App (cexternal nameIntToRaw [typeInt] typeSSizeT "((kk_ssize_t)kk_smallint_from_integer(#1))") [x]
+
+exprFromRaw :: Expr -> Expr
+exprFromRaw x
+  = App (cexternal nameIntFromRaw [typeSSizeT] typeInt "kk_integer_from_ssize_t(#1,kk_context())") [x]
+
+exprRawLit :: Integer -> Expr
+exprRawLit n
+  = App (cexternal nameRawOp [] typeSSizeT ("KK_IZ(" ++ show n ++ ")")) []
+
+exprRawAdd :: String -> Expr -> Expr -> Expr
+exprRawAdd op x y
+  = App (cexternal nameRawOp [typeSSizeT,typeSSizeT] typeSSizeT ("(#1 " ++ op ++ " #2)")) [x,y]
+
+exprRawCompare :: String -> Expr -> Expr -> Expr
+exprRawCompare cmp x y
+  = App (cexternal nameRawOp [typeSSizeT,typeSSizeT] typeBool ("(#1 " ++ cmp ++ " #2)")) [x,y]
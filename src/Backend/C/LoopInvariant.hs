@@ -0,0 +1,67 @@
+-----------------------------------------------------------------------------
+-- Copyright 2021, Microsoft Research, Daan Leijen.
+--
+-- This is free software; you can redistribute it and/or modify it under the
+-- terms of the Apache License, Version 2.0. A copy of the License can be
+-- found in the LICENSE file at the root of this distribution.
+-----------------------------------------------------------------------------
+
+{-  Borrow loop invariant parameters.
+
+    A top-level function `f` that tail calls itself becomes a loop in C, but any owned
+    parameter that is just passed along in the recursive calls (like a configuration
+    value or a function) is still dup'd and dropped by Perceus on every iteration.
+    If such a parameter is otherwise only inspected (see `inferBorrowLoop`) we generate
+    a worker `f.loop` that borrows it, and `f` just calls `f.loop`. The parameter is now
+    dropped only once by `f` after the loop is done.
+
+    The worker is private to the module so the calling convention of `f` itself
+    does not change (and other modules can keep calling it as before).
+-}
+
+module Backend.C.LoopInvariant ( loopInvariantCore ) where
+
+import Common.Name
+import Common.Syntax
+import Type.Type
+import Core.Core
+import Core.CoreVar( (|~>) )
+import Core.Borrowed( Borrowed, inferBorrowLoop )
+
+--------------------------------------------------------------------------
+-- Transform top-level recursive definitions
+--------------------------------------------------------------------------
+
+loopInvariantCore :: Borrowed -> Core -> Core
+loopInvariantCore borrowed core
+  = core{ coreProgDefs = map (loopInvariantDefGroup borrowed) (coreProgDefs core) }
+
+loopInvariantDefGroup :: Borrowed -> DefGroup -> DefGroup
+loopInvariantDefGroup borrowed dg
+  = case dg of
+      DefRec [def] -> DefRec (loopInvariantDef borrowed def)
+      _            -> dg
+
+loopInvariantDef :: Borrowed -> Def -> [Def]
+loopInvariantDef borrowed def
+  = case (splitFunExpr (defExpr def), inferBorrowLoop borrowed def) of
+      (Just (tvs,params,eff,body), Just pinfos)
+        -> -- trace ("borrow loop invariants: " ++ show (defName def) ++ ": " ++ show pinfos) $
+           let wname     = makeHiddenName "loop" (defName def)
+               wvar      = Var (TName wname (defType def)) (InfoArity (length tvs) (length params))
+               workerDef = def{ defName   = wname
+                              , defExpr   = addTypeLambdas tvs (Lam params eff ([(defTName def, wvar)] |~> body))
+                              , defVis    = Private
+                              , defSort   = DefFun pinfos
+                              , defInline = InlineNever
+                              }
+               wrapperDef = def{ defExpr = addTypeLambdas tvs (Lam params eff (App (addTypeApps tvs wvar) [Var p InfoNone | p <- params])) }
+           in [workerDef, wrapperDef]
+      _ -> [def]
+
+splitFunExpr :: Expr -> Maybe ([TypeVar],[TName],Effect,Expr)
+splitFunExpr expr
+  = case expr of
+      TypeLam tvs (Lam params eff body) -> Just (tvs,params,eff,body)
+      Lam params eff body               -> Just ([],params,eff,body)
+      _                                 -> Nothing
@@ -45,9 +45,9 @@ import Backend.C.ParcReuse( constructorSizeOf )
 -- Reference count transformation
 --------------------------------------------------------------------------
 
-parcCore :: Pretty.Env -> Platform -> Newtypes -> Borrowed -> Bool -> Core -> Unique Core
-parcCore penv platform newtypes borrowed enableSpecialize core
-  = do defs <- runParc penv platform newtypes borrowed enableSpecialize (parcDefGroups True (coreProgDefs core))
+parcCore :: Pretty.Env -> Platform -> Newtypes -> Borrowed -> Bool -> Bool -> Core -> Unique Core
+parcCore penv platform newtypes borrowed enableSpecialize enableBorrowInference core
+  = do defs <- runParc penv platform newtypes borrowed enableSpecialize enableBorrowInference (parcDefGroups True (coreProgDefs core))
        return core{coreProgDefs=defs}
   where penv' = penv{Pretty.coreShowDef=True,Pretty.coreShowTypes=False,Pretty.fullNames=False}
         tr d = trace (show (vcat (map (prettyDefGroup penv') d)))
@@ -71,7 +71,7 @@ parcDef topLevel def
   = (if topLevel then isolated_ else id) $
     withCurrentDef def $
     do -- parcTrace "enter def"
-       expr <- (if topLevel then parcTopLevelExpr (defSort def) else parcExpr) (defExpr def)
+       expr <- (if topLevel || Borrow `elem` defParamInfos def then parcTopLevelExpr (defSort def) else parcExpr) (defExpr def)
        return def{defExpr=expr}
 
 
@@ -105,7 +105,10 @@ parcExpr expr
               return (maybeStats dups $ Lam pars eff body')
       Var tname info | infoIsRefCounted info
         -> do -- parcTrace ("refcounted: " ++ show tname ++ ": " ++ show info)
-              fromMaybe expr <$> useTName tname
+              immortal <- isImmortal tname
+              if immortal
+                then return expr
+                else fromMaybe expr <$> useTName tname
 
       -- Functions/Externals are not reference-counted,
       -- but they need to be wrapped if they appear outside of an application.
@@ -148,16 +151,22 @@ parcExpr expr
       Let [] body
         -> parcExpr body
       Let (DefNonRec def:dgs) body
-        -> do def1  <- -- check if we need to name a result in case it will be dropped
+        -> do def0  <- -- check if we need to name a result in case it will be dropped
                        do mbDrop <- if (nameIsNil (defName def)) then genDrop (defTName def) else return Nothing
                           case mbDrop of
                             Just _ -- | nameIsNil (defName def) 
                               -> do name <- uniqueName "res" -- name the result
                                     return def{defName = name}
                             _ -> return def
-              body1 <- ownedInScope (bv def1) $ parcExpr (Let dgs body)
-              def2  <- parcDef False def1
-              return $ makeLet [DefNonRec def2] body1
+              -- infer borrowed parameters for local functions whose call sites are all known
+              mbBorrow <- inferLocalBorrow def0 (Let dgs body)
+              let def1 = case mbBorrow of
+                           Just (_,pinfos) -> def0{defSort = DefFun pinfos}
+                           Nothing         -> def0
+              withBorrowed mbBorrow $
+                do body1 <- ownedInScope (bv def1) $ parcExpr (Let dgs body)
+                   def2  <- parcDef False def1
+                   return $ makeLet [DefNonRec def2] body1
       Let (DefRec _ : _) _
         -> failure "Backend.C.Parc.parcExpr: Recursive definition in let"
       Case vars brs | caseIsNormalized vars brs
@@ -211,15 +220,40 @@ parcBorrowArg expr parInfo
         -> if infoIsRefCounted info
             then (\d -> ([], d, expr)) <$> useTNameBorrowed tname
             else return ([], Nothing, expr)
-      (_, Borrow)
-        -> do expr' <- parcExpr expr
-              notRefCounted <- exprIsNotRefcounted expr   -- for example, small integer literals
-              if (notRefCounted) 
-                then return ([], Nothing, expr') 
+      -- a field of a borrowed value can be passed borrowed as well (without a dup/drop)
+      (Case [Var x _] [Branch [pat] [Guard test (Var fld _)]], Borrow) | isExprTrue test && isFieldPattern (getName fld) pat
+        -> do borrowedParent <- isBorrowed x
+              if (not borrowedParent)
+                then parcBorrowArgExpr expr
                 else do argName <- uniqueName "brw"
-                        let def = makeDef argName expr'
-                        drop <- extendOwned (S.singleton (defTName def)) $ genDrop (defTName def)
-                        return ([DefNonRec def], drop, Var (defTName def) InfoNone)
+                        let def = makeDef argName expr
+                        return ([DefNonRec def], Nothing, Var (defTName def) InfoNone)
+      (_, Borrow)
+        -> parcBorrowArgExpr expr
+
+-- | Let-float a borrowed argument expression and drop it after the call
+parcBorrowArgExpr :: Expr -> Parc ([DefGroup], Maybe Expr, Expr)
+parcBorrowArgExpr expr
+  = do expr' <- parcExpr expr
+       notRefCounted <- exprIsNotRefcounted expr   -- for example, small integer literals
+       if (notRefCounted) 
+         then return ([], Nothing, expr') 
+         else do argName <- uniqueName "brw"
+                 let def = makeDef argName expr'
+                 drop <- extendOwned (S.singleton (defTName def)) $ genDrop (defTName def)
+                 return ([DefNonRec def], drop, Var (defTName def) InfoNone)
+
+-- | Is this a pattern that just projects out the given field (like the generated field selectors)
+isFieldPattern :: Name -> Pattern -> Bool
+isFieldPattern fld pat
+  = case pat of
+      PatCon{patConPatterns=pats}
+        -> all isSimple pats && length [() | PatVar pname PatWild <- pats, getName pname == fld] == 1
+      _ -> False
+  where
+    isSimple PatWild          = True
+    isSimple (PatVar _ PatWild) = True
+    isSimple _                = False
 
 varNames :: [Expr] -> [TName]
 varNames (Var tn _:exprs) = tn:varNames exprs
@@ -585,10 +619,10 @@ getBoxForm' platform newtypes tp
            case extractDataDefType tp of
              Just name
                | name `elem` [nameTpInt, nameTpCField] ||
-                 ((name `elem` [nameTpInt8, nameTpInt16, nameTpFloat16]) && sizePtr platform > 2) ||
-                 ((name `elem` [nameTpChar, nameTpInt32, nameTpFloat32]) && sizePtr platform > 4)
+                 ((name `elem` [nameTpInt8, nameTpInt16, nameTpFloat16]) && sizeField platform > 2) ||
+                 ((name `elem` [nameTpChar, nameTpInt32, nameTpFloat32]) && sizeField platform > 4)
                    -> BoxIdentity
-             _ -> if m < sizePtr platform   -- for example, `bool`, but not `int64`
+             _ -> if m < sizeField platform   -- for example, `bool`, but not `int64`
                    then BoxIdentity 
                    else BoxRaw
       Just (DataDefValue _ _)
@@ -712,6 +746,26 @@ dupDropFun isDup tp mbConRepr mbScanCount arg
     coerceTp = TFun [(nameNil,tp)] typeTotal (if isDup then tp else typeUnit)
 
 
+-- | Top-level values are marked immortal after initialization (see `Backend.C.FromCore.genMarkImmortal`)
+-- and we do not need to dup (or drop) references to them. This only holds for types that are
+-- heap allocated (and not value types as those are not marked).
+isImmortal :: TName -> Parc Bool
+isImmortal tname
+  | not (isQualified (getName tname)) = return False
+  | otherwise
+  = case extractDataDefType (typeOf tname) of
+      Nothing -> return True   -- functions and boxed values
+      Just name
+        | name `elem` [nameTpInt, nameTpString, nameTpVector, nameTpBox, nameTpAny]
+          -> return True
+        | name `elem` [nameTpRef, nameTpLocalVar, nameTpEvv, nameTpReuse, nameTpCField]
+          -> return False
+        | otherwise
+          -> do mbDi <- getDataInfo (typeOf tname)
+                return (case mbDi of
+                          Just di -> not (dataInfoIsValue di)
+                          Nothing -> False)
+
 -- | is an expression definitely not reference counted?
 exprIsNotRefcounted :: Expr -> Parc Bool
 exprIsNotRefcounted expr
@@ -756,6 +810,7 @@ data Env = Env { currentDef :: [Def],
                  platform  :: Platform,
                  newtypes  :: Newtypes,
                  enableSpec:: Bool,
+                 enableBorrowInfer :: Bool,
                  owned     :: Owned,
                  shapeMap  :: ShapeMap,
                  borrowed  :: Borrowed
@@ -786,10 +841,10 @@ updateSt = modify
 getSt :: Parc ParcState
 getSt = get
 
-runParc :: Pretty.Env -> Platform -> Newtypes -> Borrowed -> Bool -> Parc a -> Unique a
-runParc penv platform newtypes borrowed enableSpecialize (Parc action)
+runParc :: Pretty.Env -> Platform -> Newtypes -> Borrowed -> Bool -> Bool -> Parc a -> Unique a
+runParc penv platform newtypes borrowed enableSpecialize enableBorrowInference (Parc action)
   = withUnique $ \u ->
-      let env = Env [] penv platform newtypes enableSpecialize S.empty M.empty borrowed
+      let env = Env [] penv platform newtypes enableSpecialize enableBorrowInference S.empty M.empty borrowed
           st = ParcState u S.empty
           (val, st') = runState (runReaderT action env) st
        in (val, uniq st')
@@ -899,6 +954,18 @@ getShapeInfoOf tname m
       Just shape -> shape
       Nothing    -> (ShapeInfo Nothing Nothing Nothing)
 
+withBorrowed :: Maybe (Name,[ParamInfo]) -> Parc a -> Parc a
+withBorrowed Nothing action = action
+withBorrowed (Just bdef) action
+  = withEnv (\e -> e{ borrowed = borrowedExtend bdef (borrowed e) }) action
+
+inferLocalBorrow :: Def -> Expr -> Parc (Maybe (Name,[ParamInfo]))
+inferLocalBorrow def scope
+  = do env <- getEnv
+       if (enableBorrowInfer env)
+         then return (inferBorrowLocal (borrowed env) def scope)
+         else return Nothing
+
 -- | Return borrowing infos for a name. May return the empty list
 -- if no borrowing takes place.
 getParamInfos :: Name -> Parc [ParamInfo]
@@ -634,7 +634,7 @@ orderConFieldsEx platform newtypes isOpen fields
       = if (length rmixed > 1)
          then failure ("Backend.C.ParcReuse.orderConFields: multiple fields with mixed raw/scan fields itself in " ++ show fields)
          else let scanCount = scanCount0 + (if (isOpen) then 1 else 0)  -- +1 for the open datatype tag
-                  ssize = scanCount * (sizePtr platform)
+                  ssize = scanCount * (sizeField platform)
                   raws  = rmixed ++ reverse rraw
                   rsize = alignedSum ssize (map snd raws)
                   size  = alignUp rsize (sizeSize platform)
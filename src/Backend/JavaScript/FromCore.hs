@@ -871,10 +871,34 @@ genInline expr
 extractExtern :: Expr -> Maybe (TName,[(Target,String)])
 extractExtern expr
   = case expr of
-      TypeApp (Var tname (InfoExternal formats)) targs -> Just (tname,formats)
+      TypeApp (Var tname (InfoExternal formats)) targs -> Just (tname,jsTypeFormats targs formats)
       Var tname (InfoExternal formats) -> Just (tname,formats)
       _ -> Nothing
 
+-- | In a javascript external, `##N` is the array type used to store elements of type argument `N`.
+-- Vectors of `float64` and `int32` use typed arrays; any other element type uses a plain `Array`.
+-- This includes `int64`: its values are `BigInt`s and storing them in a `BigInt64Array` (or
+-- using an int53 fast path) would change the representation every `int64` primitive expects.
+jsTypeFormats :: [Type] -> [(Target,String)] -> [(Target,String)]
+jsTypeFormats targs formats
+  = [(target, if (isTargetJS target) then subst fmt else fmt) | (target,fmt) <- formats]
+  where
+    subst s
+      = case s of
+          ('\\':'#':xs)  -> '\\' : '#' : subst xs
+          ('#':'#':y:xs) | y `elem` ['1'..'9'] && i < length targs
+                          -> jsArrayOf (targs!!i) ++ subst xs
+                          where i = fromEnum y - fromEnum '1'
+          (x:xs)         -> x : subst xs
+          []             -> []
+
+jsArrayOf :: Type -> String
+jsArrayOf tp
+  = case expandSyn tp of
+      TCon tc | typeConName tc == nameTpFloat -> "Float64Array"
+              | typeConName tc == nameTpInt32 -> "Int32Array"
+      _ -> "Array"
+
 -- not fully applied external gets wrapped in a function
 genWrapExternal :: TName -> [(Target,String)] -> Asm Doc
 genWrapExternal tname formats
@@ -933,8 +957,8 @@ genExprExternalPrim tname formats argDocs0
      = empty
     ppExternalF name k@('\\':'#':xs) args
      = char '#' <.> ppExternalF name xs args
-    ppExternalF name k@('#':'#':xs) args
-     = failure ("Backend.JavaScript.FromCore: type arguments in javascript external in: " ++ show tname)
+    ppExternalF name k@('#':'#':y:xs) args  -- unknown type argument (see `jsTypeFormats`)
+     = text "Array" <.> ppExternalF name xs args
     ppExternalF name k@('#':y:xs)  args
      = if  y `elem` ['1'..'9']
         then (let n = length args
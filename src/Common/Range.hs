@@ -49,7 +49,9 @@ bstringEmpty = B.empty
 
 bstringToText bstr = T.pack (BC.unpack bstr) -- utfDecode bstr -- T.decodeUtf8With E.lenientDecode bstr  
 
-bstringToString bstr = T.unpack (T.decodeUtf8 bstr) -- (bstringToText bstr)
+bstringToString bstr 
+  = if B.all (< 0x80) bstr then BC.unpack bstr  -- fast path for ascii
+                           else T.unpack (T.decodeUtf8 bstr) -- (bstringToText bstr)
 
 stringToBString str = T.encodeUtf8 (T.pack str)
 
@@ -212,8 +214,12 @@ makePos = Pos
 
 
 posMoves8 :: Pos -> BString -> Pos
-posMoves8 pos bstr
-  = BC.foldl posMove8 pos bstr
+posMoves8 pos@(Pos s o l c) bstr
+  | not (BC.any (\ch -> ch == '\n' || ch == '\t') bstr)   -- fast path: most tokens are on a single line
+    = let n = B.length bstr
+      in Pos s (if o < 0 then o else o+n) l (c+n)
+  | otherwise
+    = BC.foldl' posMove8 pos bstr
 
 posMove8 :: Pos -> Char -> Pos
 posMove8 (Pos s o l c) ch
@@ -31,7 +31,7 @@ module Compiler.Compile( -- * Compile
 import Lib.Trace              ( trace )
 import Data.Char              ( isAlphaNum, toLower, isSpace )
 
-import System.Directory       ( createDirectoryIfMissing, canonicalizePath, getCurrentDirectory, doesDirectoryExist )
+import System.Directory       ( createDirectoryIfMissing, canonicalizePath, getCurrentDirectory, doesDirectoryExist, getFileSize )
 import Data.Maybe             ( catMaybes )
 import Data.List              ( isPrefixOf, intersperse )
 import qualified Data.Set as S
@@ -60,6 +60,7 @@ import Core.Check             ( checkCore )
 import Core.UnReturn          ( unreturn )
 import Core.OpenResolve       ( openResolve )
 import Core.FunLift           ( liftFunctions )
+import Core.HandleResolve     ( handleResolve )
 import Core.Monadic           ( monTransform )
 import Core.MonadicLift       ( monadicLift )
 import Core.Inlines           ( inlinesExtends, extractInlineDefs, inlinesMerge, inlinesToList, inlinesFilter, inlinesNew )
@@ -105,6 +106,8 @@ import Core.CTail( ctailOptimize )
 
 import System.Directory ( doesFileExist )
 import Compiler.Package
+import Compiler.ReplHost       ( replHostEval, replNextId )
+import Compiler.Timing         ( timeIO, timeStart, timeMarkPure )
 -- import qualified Core.Check
 
 -- Debugging
@@ -347,7 +350,8 @@ compileProgramFromFile term flags modules compileTarget rootPath stem
        liftIO $ termPhase term ("parsing " ++ fname)
        exist <- liftIO $ doesFileExist fname
        if (exist) then return () else liftError $ errorMsg (errorFileNotFound flags fname)
-       program <- lift $ parseProgramFromFile (semiInsert flags) fname
+       program <- lift $ timeIO (show (nameFromFile stem)) "parse" $
+                  parseProgramFromFile (semiInsert flags) fname
        let isSuffix = map (\c -> if isPathSep c then '/' else c) (noexts stem)
                        `endsWith` show (programName program)
            ppcolor c doc = color (c (colors (prettyEnvFromFlags flags))) doc
@@ -406,6 +410,7 @@ compileProgram' term flags modules compileTarget fname program
                                           (imp:_) -> importVis imp -- TODO: get max
                               in if (modName mod == name) then []
                                   else [Core.Import (modName mod) (modPackagePath mod) vis (Core.coreProgDoc (modCore mod))]
+       liftIO $ timeStart (show name)
        (loaded2a, coreDoc) <- liftError $ typeCheck loaded1 flags 0 coreImports program       
        when (showCore flags) $
          liftIO (termDoc term (vcat [
@@ -674,7 +679,7 @@ resolveModule term flags currentDir modules mimp
                       Nothing
                        -> do loadMessage "loading:"
                              ftime  <- liftIO $ getFileTime iface
-                             (core,parseInlines) <- lift $ parseCore iface
+                             (core,parseInlines) <- lift $ timeIO (show name) "load interface" $ parseCore iface
                              -- let core = uniquefy core0
                              outIFace <- liftIO $ copyIFaceToOutputDir term flags iface core
                              let mod = Module (Core.coreName core) outIFace (joinPath root stem) pkgQname pkgLocal []
@@ -840,6 +845,15 @@ inferCheck loaded0 flags line coreImports program
               where 
                 showDef def = show (Core.Pretty.prettyDef (penv{coreShowDef=True}) def)
 
+            -- with `--timepasses`, attribute the time since the previous mark to `phase` (see "Compiler.Timing")
+            timeMarkWith phase x
+              = when (not (null (timePasses flags))) $
+                timeMarkPure phase x (return ())
+            timeMarkDefs phase
+              = do defs <- Core.getCoreDefs
+                   timeMarkWith phase (sum (map (Core.costExpr . Core.defExpr) (Core.flattenDefGroups defs)))
+
+       timeMarkWith "kind inference" (length defs)
 
        -- Type inference
        (gamma,cdefs,mbRangeMap)
@@ -854,6 +868,7 @@ inferCheck loaded0 flags line coreImports program
               (getName program)
               defs 
        Core.setCoreDefs cdefs      
+       timeMarkDefs "type inference"
        
        -- check generated core
        let checkCoreDefs title = when (coreCheck flags) (trace ("checking " ++ title) $ 
@@ -872,6 +887,7 @@ inferCheck loaded0 flags line coreImports program
                               simplifyX (simplifyMaxDup flags)
            simplifyNoDup    = simplifyX 0
        simplifyNoDup
+       timeMarkDefs "simplify"
        -- traceDefGroups "simplify1"
 
        -- inline: inline local definitions more aggressively (2x)
@@ -879,14 +895,22 @@ inferCheck loaded0 flags line coreImports program
          let inlines = if (isPrimitiveModule (Core.coreProgName coreProgram)) then loadedInlines loaded
                          else inlinesFilter (\name -> nameId nameCoreHnd /= nameModule name) (loadedInlines loaded)
          in inlineDefs penv (2*(optInlineMax flags)) inlines
+       timeMarkDefs "inline"
        -- checkCoreDefs "inlined"
 
        simplifyDupN
+       timeMarkDefs "simplify"
        -- traceDefGroups "inlined"
 
+       -- resolve operations of a handler in the same function body (before lifting local loops)
+       when (optimize flags > 0 && optInlineMax flags > 0) $
+         handleResolve newtypes (optInlineMax flags)
+       timeMarkDefs "handle resolve"
+
        -- lift recursive functions to top-level before specialize (so specializeDefs do not contain local recursive definitions)
        liftFunctions penv
        checkCoreDefs "lifted"      
+       timeMarkDefs "lift"
        -- traceDefGroups "lifted"
 
        -- specialize 
@@ -906,9 +930,11 @@ inferCheck loaded0 flags line coreImports program
             liftFunctions penv
             checkCoreDefs "specialized"
             -- traceDefGroups "specialized and lifted"          
+       timeMarkDefs "specialize"
     
        -- simplify once more
        simplifyDupN
+       timeMarkDefs "simplify"
        coreDefsInlined <- Core.getCoreDefs
        -- traceDefGroups "simplified"
       
@@ -919,6 +945,7 @@ inferCheck loaded0 flags line coreImports program
        -- tail-call-modulo-cons optimization
        when (optctail flags) $
          ctailOptimize penv (platform flags) newtypes gamma (optctailInline flags) 
+       timeMarkDefs "ctail"
       
        -- transform effects to explicit monadic binding (and resolve .open calls)
        when (enableMon flags && not (isPrimitiveModule (Core.coreProgName coreProgram))) $
@@ -934,12 +961,14 @@ inferCheck loaded0 flags line coreImports program
        -- monadic lifting to create fast inlined paths
        monadicLift penv
        checkCoreDefs "monadic lifting"
+       timeMarkDefs "monadic"
        -- traceDefGroups "monadic lift"
 
       -- now inline primitive definitions (like yield-bind)
        let inlinesX = inlinesFilter isPrimitiveName (loadedInlines loaded)
        -- trace ("inlines2: " ++ show (map Core.inlineName (inlinesToList inlinesX))) $
        inlineDefs penv (2*optInlineMax flags) inlinesX -- (loadedInlines loaded)
+       timeMarkDefs "inline"
               
        -- remove remaining open calls; this may change effect types
        simplifyDefs penv True {-unsafe-} ndebug (simplify flags) 0 -- remove remaining .open
@@ -947,6 +976,7 @@ inferCheck loaded0 flags line coreImports program
        -- final simplification
        simplifyDupN
        checkCoreDefs "final" 
+       timeMarkDefs "simplify"
        -- traceDefGroups "simplify final"
 
        -- Assemble core program and return
@@ -1228,9 +1258,13 @@ codeGenC sourceFile newtypes borrowed0 unique0 term flags modules compileTarget
       when (showFinalCore flags) $
         do termDoc term bcoreDoc
 
+      let unit = show (Core.coreProgName core0)
+      -- forces all core transformations of `cFromCore`: boxing, int ranges, parc, and reuse
+      timeIO unit "c backend core" $ return (sum (map (Core.costExpr . Core.defExpr) (Core.flattenDefGroups (Core.coreProgDefs bcore))))
       termPhase term ( "generate c: " ++ outBase )
-      writeDocW 120 outC (cdoc <.> linebreak)
-      writeDocW 120 outH (hdoc <.> linebreak)
+      timeIO unit "c generation" $
+        do writeDocW 120 outC (cdoc <.> linebreak)
+           writeDocW 120 outH (hdoc <.> linebreak)
       when (showAsmC flags) (termDoc term (hdoc <//> cdoc))
 
       -- copy libraries
@@ -1239,8 +1273,12 @@ codeGenC sourceFile newtypes borrowed0 unique0 term flags modules compileTarget
           clibs    = clibsFromCore flags bcore 
       extraIncDirs <- fmap concat $ mapM (copyCLibrary term flags cc) eimports
 
-      -- compile      
-      ccompile term flags cc outBase extraIncDirs [outC] 
+      -- compile (as position independent code if evaluated by the interactive host)
+      let useHost   = replHost flags && Core.coreProgName core0 == nameInteractiveModule
+                      && not onWindows && not (isTargetWasm (target flags))
+          ccMain    = if useHost then cc{ ccFlagsCompile = ccFlagsCompile cc ++ ["-fPIC"] } else cc
+          flagsMain = if useHost then flags{ ccompDefs = ccompDefs flags ++ [("KK_REPL_ENTRY","1")] } else flags
+      ccompile term flagsMain ccMain outBase extraIncDirs [outC] 
 
       -- compile and link?
       case mbEntry of
@@ -1292,29 +1330,78 @@ codeGenC sourceFile newtypes borrowed0 unique0 term flags modules compileTarget
                          ++ map (ccAddLib cc) libpaths  -- libs
                          ++ map (ccAddSysLib cc) syslibs
                          
-
-            termPhaseDoc term (color (colorInterpreter (colorScheme flags)) (text "linking:") <+>
-                               color (colorSource (colorScheme flags)) (text mainName))
-            runCommand term flags clink
-
-            let mainTarget = mainExe ++ targetExeExtension (target flags)
-            when (not (null (outFinalPath flags))) $
-              termPhaseDoc term $ color (colorInterpreter (colorScheme flags)) (text "created:") <+>
-                                    color (colorSource (colorScheme flags)) (text (normalizeWith pathSep mainTarget))
-            let cmdflags = if (showElapsed flags) then " --kktime" else ""
+            if useHost 
+             then replHostLink term flags cc mainName 
+                    ([kklibObj] ++ [outName flags (ccObjFile cc (showModName mname)) 
+                                   | mname <- map modName modules, mname /= nameInteractiveModule])
+                    (outName flags (ccObjFile cc mainModName)) libpaths syslibs
+             else do
+               termPhaseDoc term (color (colorInterpreter (colorScheme flags)) (text "linking:") <+>
+                                  color (colorSource (colorScheme flags)) (text mainName))
+               timeIO mainName "link" $ runCommand term flags clink
+
+               let mainTarget = mainExe ++ targetExeExtension (target flags)
+               exeSize <- fmap show (getFileSize mainTarget) `catchIO` (\_ -> return "?")
+               termPhase term ("binary size: " ++ exeSize ++ " bytes")
+               when (not (null (outFinalPath flags))) $
+                 termPhaseDoc term $ color (colorInterpreter (colorScheme flags)) (text "created:") <+>
+                                       color (colorSource (colorScheme flags)) (text (normalizeWith pathSep mainTarget))
+               let cmdflags = if (showElapsed flags) then " --kktime" else ""
             
-            case target flags of
-              C Wasm 
-                -> do return (Just (mainTarget, 
-                               runSystemEcho term flags (wasmrun flags ++ " " ++ dquote mainTarget ++ cmdflags ++ " " ++ execOpts flags))) 
-              C WasmWeb
-                -> do return (Just (mainTarget, runSystemEcho term flags (dquote mainTarget ++ " &")))                
-              C WasmJs
-                -> do let nodeStack = if (stksize == 0) then 100000 else (stksize `div` 1024)
-                      return (Just (mainTarget, 
-                               runCommand term flags [node flags,"--stack-size=" ++ show nodeStack,mainTarget]))                               
-              _ -> do return (Just (mainTarget, 
-                               runSystemEcho term flags (dquote mainExe ++ cmdflags ++ " " ++ execOpts flags))) -- use shell for proper rss accounting
+               case target flags of
+                 C Wasm 
+                   -> do return (Just (mainTarget, 
+                                  runSystemEcho term flags (wasmrun flags ++ " " ++ dquote mainTarget ++ cmdflags ++ " " ++ execOpts flags))) 
+                 C WasmWeb
+                   -> do return (Just (mainTarget, runSystemEcho term flags (dquote mainTarget ++ " &")))                
+                 C WasmJs
+                   -> do let nodeStack = if (stksize == 0) then 100000 else (stksize `div` 1024)
+                         return (Just (mainTarget, 
+                                  runCommand term flags [node flags,"--stack-size=" ++ show nodeStack,mainTarget]))                               
+                 _ -> do return (Just (mainTarget, 
+                                  runSystemEcho term flags (dquote mainExe ++ cmdflags ++ " " ++ execOpts flags))) -- use shell for proper rss accounting
+
+
+-- Link the interactive module as a shared object that is evaluated by a persistent host process
+-- (see "Compiler.ReplHost"). The host executable links `kklib` and all imported modules and
+-- is only relinked when one of those objects changes.
+replHostLink :: Terminal -> Flags -> CC -> String -> [FilePath] -> FilePath -> [FilePath] -> [String] -> IO (Maybe (FilePath,IO ()))
+replHostLink term flags cc mainName hostObjs mainObj libpaths syslibs
+  = do let hostBase = outName flags "kkrepl-host"
+           hostC    = joinPath (localShareDir flags) "kklib/src/replhost.c"
+           hostObj  = outName flags (ccObjFile cc "kkrepl-host")
+           hostExe  = hostBase ++ targetExeExtension (target flags)
+       times <- mapM getFileTime (hostObjs ++ libpaths)
+       n     <- replNextId
+       let key      = show (zip (hostObjs ++ libpaths) times)
+           soPath   = outName flags (mainName ++ "-" ++ show n) ++ dllExtension
+           libFlags = map (ccAddLib cc) libpaths ++ map (ccAddSysLib cc) syslibs
+           linkHost = do termPhaseDoc term (color (colorInterpreter (colorScheme flags)) (text "linking:") <+>
+                                            color (colorSource (colorScheme flags)) (text "kkrepl-host"))
+                         ccompile term flags cc hostBase [] [hostC]
+                         runCommand term flags $ concat $
+                           [ [ccPath cc]
+                           , ccFlags cc
+                           , ccFlagsBuildFromFlags cc flags
+                           , ccTargetExe cc hostBase
+                           , ["-rdynamic"]     -- export all symbols to the loaded shared objects
+                           , hostObj : hostObjs
+                           , ccFlagsLink cc
+                           , libFlags
+                           , ccAddSysLib cc "dl"  -- only the host uses the dynamic loader
+                           ]
+       termPhaseDoc term (color (colorInterpreter (colorScheme flags)) (text "linking:") <+>
+                          color (colorSource (colorScheme flags)) (text mainName))
+       runCommand term flags $ concat $
+         [ [ccPath cc]
+         , ccFlags cc
+         , ccFlagsBuildFromFlags cc flags
+         , ["-shared","-o",soPath]
+         , if onMacOS then ["-undefined","dynamic_lookup"] else []
+         , [mainObj]
+         , libFlags
+         ]
+       return (Just (soPath, replHostEval key linkHost hostExe soPath))
 
 
 ccompile :: Terminal -> Flags -> CC -> FilePath -> [FilePath] -> [FilePath] -> IO ()
@@ -1335,7 +1422,7 @@ ccompile term flags cc ctargetObj extraIncDirs csources
                       [ ccTargetObj cc (notext ctargetObj)
                       , csources
                       ]
-       runCommand term flags cmdline
+       timeIO (unwords csources) "c compile" $ runCommand term flags cmdline
 
 
 -- copy static C library to the output directory (so we can link and/or bundle) and 
@@ -14,7 +14,7 @@ module Compiler.Module( Module(..), Modules, moduleNull
                       , loadedImportModule
                       , loadedName
                       , loadedLatest
-                      , addOrReplaceModule, removeModule
+                      , addOrReplaceModule, removeModule, removeModulesWithDependents
                       , modPackageName -- , modPackageQName
                       , modPackagePath, modPackageQPath
                       , PackageName
@@ -24,6 +24,7 @@ module Compiler.Module( Module(..), Modules, moduleNull
 import Lib.Trace
 import Lib.PPrint
 import Data.Char              ( isAlphaNum )
+import Data.List              ( partition )
 import Common.Range           ( Range )
 import Common.Name            ( Name, newName, unqualify, isHiddenName, showPlain)
 import Common.Error
@@ -170,6 +171,16 @@ removeModule :: Name -> Modules -> Modules
 removeModule name modules
   = filter (\m -> modName m /= name) modules
 
+-- | Remove the given modules together with all modules that (transitively) import them.
+removeModulesWithDependents :: [Name] -> Modules -> Modules
+removeModulesWithDependents []    modules = modules
+removeModulesWithDependents names modules
+  = let (removed,kept) = partition (\m -> modName m `elem` names || any (`elem` names) (modImportNames m)) modules
+    in if null removed then modules
+        else removeModulesWithDependents (map modName removed) kept
+  where
+    modImportNames m = map Core.importName (Core.coreProgImports (modCore m))
+
 extractFixities :: Core.Core -> Fixities
 extractFixities core
   = fixitiesNew [(name,fix) | Core.FixDef name fix <- Core.coreProgFixDefs core]
@@ -183,6 +183,10 @@ data Flags
          , asan             :: Bool
          , useStdAlloc      :: Bool -- don't use mimalloc for better asan and valgrind support
          , optSpecialize    :: Bool
+         , replHost         :: Bool -- evaluate interactive expressions in a persistent host process
+         , watch            :: Bool -- keep running and recompile changed modules
+         , timePasses       :: FilePath -- write per phase compile times as JSON (if not empty)
+         , useLTO           :: Bool -- link-time optimization across all modules and kklib
          }
 
 flagsNull :: Flags
@@ -272,10 +276,14 @@ flagsNull
           True -- parc reuse
           True -- parc specialize
           True -- parc reuse specialize
-          False -- parc borrow inference
+          True  -- parc borrow inference (of local functions)
           False -- use asan
           False -- use stdalloc
           True  -- use specialization (only used if optimization level >= 1)
+          True  -- use a persistent host for interactive evaluation
+          False -- watch
+          ""    -- time passes
+          False -- use link-time optimization
 
 isHelp Help = True
 isHelp _    = False
@@ -310,6 +318,7 @@ options = (\(xss,yss) -> (concat xss, concat yss)) $ unzip
  , flag   ['g'] ["debug"]           (\b f -> f{debug=b})            "emit debug information (on by default)" 
  , numOption 1 "n" ['v'] ["verbose"] (\i f -> f{verbose=i})         "verbosity 'n' (0=quiet, 1=default, 2=trace)"
  , flag   ['r'] ["rebuild"]         (\b f -> f{rebuild = b})        "rebuild all"
+ , flag   ['w'] ["watch"]           (\b f -> f{watch = b})          "keep running and recompile modules when their source changes"
  , flag   ['l'] ["library"]         (\b f -> f{library=b, evaluate=if b then False else (evaluate f) }) "generate a library"
  , configstr [] ["target"]          (map fst targets) "tgt" targetFlag  ("target: " ++ show (map fst targets))
  -- , config []    ["host"]            [("node",Node),("browser",Browser)] "host" (\h f -> f{ target=JS, host=h}) "specify host for javascript: <node|browser>"
@@ -333,6 +342,7 @@ options = (\(xss,yss) -> (concat xss, concat yss)) $ unzip
  , option []    ["vcpkgtriplet"]    (ReqArg ccVcpkgTriplet "tt")    "vcpkg target triplet"
  , option []    ["conan"]           (ReqArg ccConan "cmd")          "conan command"
  , flag   []    ["autoinstall"]     (\b f -> f{autoInstallLibs=b})  "automatically download required packages"
+ , flag   []    ["lto"]             (\b f -> f{useLTO=b})           "whole program link-time optimization (inlines across modules)"
  , option []    ["csc"]             (ReqArg cscFlag "cmd")          "use <cmd> as the csharp backend compiler "
  , option []    ["node"]            (ReqArg nodeFlag "cmd")         "use <cmd> to execute node"
  , option []    ["wasmrun"]         (ReqArg wasmrunFlag "cmd")      "use <cmd> to execute wasm"
@@ -349,6 +359,7 @@ options = (\(xss,yss) -> (concat xss, concat yss)) $ unzip
  , emptyline
  
  , flag   []    ["showtime"]       (\b f -> f{ showElapsed = b})    "show elapsed time and rss after evaluation"
+ , option []    ["timepasses"]     (ReqArg timePassesFlag "file")  "write the compile time per phase as JSON to <file>"
  , flag   []    ["showspan"]       (\b f -> f{ showSpan = b})       "show ending row/column too on errors"
  , flag   []    ["showkindsigs"]   (\b f -> f{showKindSigs=b})      "show kind signatures of type definitions"
  , flag   []    ["showtypesigs"]   (\b f -> f{_showTypeSigs=b})      "show type signatures of definitions"
@@ -372,13 +383,14 @@ options = (\(xss,yss) -> (concat xss, concat yss)) $ unzip
  , hide $ fnum 10 "n" ["inline"]    (\i f -> f{optInlineMax=i})      "set 'n' as maximum inline threshold (=10)"
  , hide $ fflag       ["monadic"]   (\b f -> f{enableMon=b})         "enable monadic translation"
  , hide $ flag []     ["semi"]      (\b f -> f{semiInsert=b})        "insert semicolons based on layout"
- , hide $ fflag       ["binference"]   (\b f -> f{parcBorrowInference=b})     "enable reuse inference (does not work cross-module!)"
+ , hide $ fflag       ["binference"]   (\b f -> f{parcBorrowInference=b})     "enable borrow inference for local functions"
  , hide $ fflag       ["optreuse"]     (\b f -> f{parcReuse=b})          "enable in-place update analysis"
  , hide $ fflag       ["optdropspec"]  (\b f -> f{parcSpecialize=b}) "enable drop specialization"
  , hide $ fflag       ["optreusespec"] (\b f -> f{parcReuseSpec=b})  "enable reuse specialization"
  , hide $ fflag       ["opttrmc"]      (\b f -> f{optctail=b})              "enable tail-recursion-modulo-cons optimization"
  , hide $ fflag       ["opttrmcinline"] (\b f -> f{optctailInline=b})  "enable trmc inlining (increases code size)"
  , hide $ fflag       ["specialize"]  (\b f -> f{optSpecialize=b})      "enable inline specialization"
+ , hide $ fflag       ["replhost"]    (\b f -> f{replHost=b})         "evaluate interactive expressions in a persistent host"
 
  -- deprecated
  , hide $ option []    ["cmake"]           (ReqArg cmakeFlag "cmd")        "use <cmd> to invoke cmake"
@@ -437,6 +449,7 @@ options = (\(xss,yss) -> (concat xss, concat yss)) $ unzip
     [("c",      \f -> f{ target=C LibC, platform=platform64 }),
      ("c64",    \f -> f{ target=C LibC, platform=platform64 }),
      ("c32",    \f -> f{ target=C LibC, platform=platform32 }),
+     ("c64c",   \f -> f{ target=C LibC, platform=platform64c }),
      ("js",     \f -> f{ target=JS JsNode, platform=platformJS }),
      ("jsnode", \f -> f{ target=JS JsNode, platform=platformJS }),
      ("jsweb",  \f -> f{ target=JS JsWeb, platform=platformJS }),
@@ -541,6 +554,9 @@ options = (\(xss,yss) -> (concat xss, concat yss)) $ unzip
   redirectFlag s
     = Flag (\f -> f{ redirectOutput = s })
 
+  timePassesFlag s
+    = Flag (\f -> f{ timePasses = s })
+
   cmakeFlag s
       = Flag (\f -> f{ cmake = s })
 
@@ -659,6 +675,7 @@ processOptions flags0 opts
                        cdefs    = ccompDefs flags 
                                    ++ if stdAlloc then [] else [("KK_MIMALLOC",show (sizePtr (platform flags)))]
                                    ++ if (buildType flags > DebugFull) then [] else [("KK_DEBUG_FULL","")]
+                                   ++ if (platformHasCompressedFields (platform flags)) then [("KK_INTB_SIZE",show (sizeField (platform flags)))] else []
                    
                    -- vcpkg
                    -- (vcpkgRoot,vcpkg) <- vcpkgFindRoot (vcpkgRoot flags)
@@ -985,8 +1002,10 @@ ccGcc name opt platform path
           (Release,       arch ++ [optFlag, "-DNDEBUG"]) ]
         )
         (gnuWarn ++ ["-Wno-unused-but-set-variable"])
-        (["-c"]) -- ++ (if onWindows then [] else ["-D_GNU_SOURCE"]))
-        []
+        (["-c","-ffunction-sections","-fdata-sections"]) -- ++ (if onWindows then [] else ["-D_GNU_SOURCE"]))
+        -- drop unreferenced definitions of all modules; note that module initializers are always
+        -- linked and keep alive everything they reference (but computed top-level values are lazy)
+        (if onMacOS then ["-Wl,-dead_strip"] else ["-Wl,--gc-sections"])
         (\stksize -> if (onMacOS && stksize > 0)  -- stack size is usually set programmatically (except on macos/windows)
                        then ["-Wl,-stack_size,0x" ++ showHex 0 stksize]
                        else []) 
@@ -1019,8 +1038,8 @@ ccMsvc name opt platform path
           (Release,words "-MD -O2 -Ob2 -DNDEBUG"),
           (RelWithDebInfo,words "-MD -Zi -O2 -Ob2 -DNDEBUG")]
          ["-W3"]
-         ["-EHs","-TP","-c"]   -- always compile as C++ on msvc (for atomics etc.)
-         ["-link"]             -- , "/NODEFAULTLIB:msvcrt"]
+         ["-EHs","-TP","-c","-Gy"]   -- always compile as C++ on msvc (for atomics etc.)
+         ["-link","/OPT:REF"]        -- , "/NODEFAULTLIB:msvcrt"]
          (\stksize -> if stksize > 0 then ["/STACK:" ++ show stksize] else [])
          (\heapsize -> [])        
          (\libdir -> ["/LIBPATH:" ++ libdir])
@@ -1055,7 +1074,7 @@ ccFromPath flags path
                                      ++ words "-Wno-cast-qual -Wno-undef -Wno-reserved-id-macro -Wno-unused-macros -Wno-cast-align"
                                      ++ (if onMacOS && cpuArch == "arm64" then ["-Wno-unknown-warning-option","-Wno-unused-but-set-variable"] else []) 
                      }
-        generic = gcc{ ccFlagsWarn = [] }
+        generic = gcc{ ccFlagsWarn = [], ccFlagsCompile = ["-c"], ccFlagsLink = [] }
         msvc    = ccMsvc name (optimize flags) (platform flags) path
         clangcl = msvc{ ccFlagsWarn = ["-Wno-everything"] ++ ccFlagsWarn clang ++ 
                                       words "-Wno-extra-semi-stmt -Wno-extra-semi -Wno-float-equal",
@@ -1074,8 +1093,20 @@ ccFromPath flags path
                 | (name == "cc") = generic
                 | otherwise      = gcc
 
-        cc = cc0{ ccFlagsCompile = ccFlagsCompile cc0 ++ ccompCompileArgs flags
-                , ccFlagsLink    = ccFlagsLink cc0 ++ ccompLinkArgs flags }
+        cc1 = cc0{ ccFlagsCompile = ccFlagsCompile cc0 ++ ccompCompileArgs flags
+                 , ccFlagsLink    = ccFlagsLink cc0 ++ ccompLinkArgs flags }
+
+        -- with link-time optimization the C compiler can inline small functions across
+        -- the generated modules and kklib (which are otherwise separate translation units)
+        cc  | not (useLTO flags) = cc1
+            | ccName cc1 == "cl" || ccName cc1 `startsWith` "clang-cl"
+              = cc1{ ccName         = ccName cc1 ++ "-lto"
+                   , ccFlagsCompile = ccFlagsCompile cc1 ++ ["-GL"]
+                   , ccFlagsLink    = ccFlagsLink cc1 ++ ["-LTCG"] }
+            | otherwise
+              = cc1{ ccName         = ccName cc1 ++ "-lto"
+                   , ccFlagsCompile = ccFlagsCompile cc1 ++ ["-flto"]
+                   , ccFlagsLink    = ccFlagsLink cc1 ++ ["-flto"] }
 
     in do when (isTargetWasm (target flags) && not (name `startsWith` "emcc")) $
             putStrLn ("\nwarning: a wasm target should use the emscripten compiler (emcc),\n  but currently '" 
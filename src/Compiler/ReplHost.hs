@@ -0,0 +1,135 @@
+{-# LANGUAGE CPP #-}
+-----------------------------------------------------------------------------
+-- Copyright 2012-2021, Microsoft Research, Daan Leijen.
+--
+-- This is free software; you can redistribute it and/or modify it under the
+-- terms of the Apache License, Version 2.0. A copy of the License can be
+-- found in the LICENSE file at the root of this distribution.
+-----------------------------------------------------------------------------
+{-
+    Persistent host process for interactive evaluation.
+
+    Instead of linking a new executable for every expression, the interpreter
+    keeps a host process running that has `kklib` and all imported modules
+    linked in. Each expression is compiled to a small shared object that the
+    host loads and runs (see `kklib/src/replhost.c`).
+    The host is relinked only when the set of linked modules changes.
+
+    Commands and replies use two extra pipes (passed to the host in
+    `KK_REPL_FDS`) so the standard input, output, and error stay with
+    the evaluated program.
+-}
+-----------------------------------------------------------------------------
+module Compiler.ReplHost( replHostEval, replHostStop, replNextId ) where
+
+import Data.IORef
+import System.IO
+import System.Process
+import System.Directory   ( removeFile )
+#ifndef WINDOWS
+import System.Environment ( getEnvironment )
+import GHC.IO.Handle.FD   ( fdToHandle )
+import System.Posix.Internals ( setCloseOnExec, c_close )
+#endif
+import Platform.Runtime   ( unsafePerformIO )
+import Common.Failure     ( raiseIO, catchIO )
+
+data Host = Host{ hostKey   :: String        -- identifies the linked objects
+                , hostCmd   :: Handle        -- paths of shared objects to evaluate
+                , hostReply :: Handle        -- `replDone` after each evaluation
+                , hostProc  :: ProcessHandle
+                }
+
+{-# NOINLINE vhost #-}
+vhost :: IORef (Maybe Host)
+vhost = unsafePerformIO $ newIORef Nothing
+
+{-# NOINLINE vcount #-}
+vcount :: IORef Int
+vcount = unsafePerformIO $ newIORef 0
+
+-- | Unique number for naming the shared object of each evaluation
+-- (a loaded shared object cannot be overwritten on all platforms).
+replNextId :: IO Int
+replNextId
+  = do n <- readIORef vcount
+       writeIORef vcount (n+1)
+       return n
+
+-- | Evaluate the shared object `soPath` in the host; `key` identifies the objects
+-- linked into the host executable `hostExe`. If the key changed (or the host
+-- terminated) the host is relinked using `linkHost` and restarted.
+replHostEval :: String -> IO () -> FilePath -> FilePath -> IO ()
+replHostEval key linkHost hostExe soPath
+  = do host <- getHost
+       hPutStrLn (hostCmd host) soPath
+       hFlush (hostCmd host)
+       waitDone host
+       -- the host keeps the loaded object mapped, so we can remove the file already
+       catchIO (removeFile soPath) (\_ -> return ())
+  where
+    getHost
+      = do mbHost <- readIORef vhost
+           case mbHost of
+             Just host | hostKey host == key
+               -> do exit <- getProcessExitCode (hostProc host)
+                     case exit of
+                       Nothing -> return host
+                       Just _  -> startHost
+             _ -> do replHostStop
+                     startHost
+
+    startHost
+      = do linkHost
+           (hcmd,hreply,ph) <- spawnHost hostExe
+           hSetBuffering hcmd LineBuffering
+           let host = Host key hcmd hreply ph
+           writeIORef vhost (Just host)
+           return host
+
+    -- the reply channel only carries `replDone` lines
+    waitDone host
+      = do eof <- hIsEOF (hostReply host)
+           if eof
+            then do writeIORef vhost Nothing
+                    _ <- waitForProcess (hostProc host)
+                    raiseIO "interactive evaluation host terminated"
+            else do line <- hGetLine (hostReply host)
+                    if (line == replDone)
+                     then return ()
+                     else waitDone host
+
+-- | Start the host with the command and reply pipes; the standard handles are inherited.
+spawnHost :: FilePath -> IO (Handle,Handle,ProcessHandle)
+#ifndef WINDOWS
+spawnHost hostExe
+  = do (cmdRead,cmdWrite)     <- createPipeFd
+       (replyRead,replyWrite) <- createPipeFd
+       mapM_ setCloseOnExec [cmdWrite,replyRead]   -- our ends must not be inherited by the host
+       env <- getEnvironment
+       let fds = show cmdRead ++ "," ++ show replyWrite
+       (_, _, _, ph) <- createProcess (proc hostExe []){ env = Just (("KK_REPL_FDS",fds) : filter ((/="KK_REPL_FDS") . fst) env) }
+       mapM_ c_close [cmdRead,replyWrite]          -- now only open in the host
+       hcmd   <- fdToHandle cmdWrite
+       hreply <- fdToHandle replyRead
+       return (hcmd,hreply,ph)
+#else
+spawnHost hostExe
+  = raiseIO "the interactive evaluation host is not supported on Windows"
+#endif
+
+-- | Terminate the current host (if any).
+replHostStop :: IO ()
+replHostStop
+  = do mbHost <- readIORef vhost
+       writeIORef vhost Nothing
+       case mbHost of
+         Nothing   -> return ()
+         Just host -> do catchIO (hClose (hostCmd host)) (\_ -> return ())
+                         _ <- waitForProcess (hostProc host)
+                         catchIO (hClose (hostReply host)) (\_ -> return ())
+                         return ()
+
+-- must match `KK_REPL_DONE` in `kklib.h`
+replDone :: String
+replDone = "\ESC[kk-repl-done]"
@@ -0,0 +1,139 @@
+-----------------------------------------------------------------------------
+-- Copyright 2012-2021, Microsoft Research, Daan Leijen.
+--
+-- This is free software; you can redistribute it and/or modify it under the
+-- terms of the Apache License, Version 2.0. A copy of the License can be
+-- found in the LICENSE file at the root of this distribution.
+-----------------------------------------------------------------------------
+{-
+    Per phase compile time instrumentation (`--timepasses=<file>`).
+
+    Records the wall clock time and the allocated bytes per (module,phase).
+    IO actions are timed with `timeIO`. The (lazy) core phases are timed by
+    placing marks between them with `timeMarkPure`: each mark forces its
+    argument first and attributes the time since the previous mark to its phase.
+    The results are written as JSON for tracking over time.
+-}
+-----------------------------------------------------------------------------
+module Compiler.Timing( timingEnable, timingEnabled
+                      , timeIO
+                      , timeStart, timeMark, timeMarkPure
+                      , timingWrite
+                      ) where
+
+import Data.IORef
+import Data.Int           ( Int64 )
+import Data.List          ( intercalate )
+import Control.Exception  ( evaluate )
+import System.Mem         ( getAllocationCounter )
+import Numeric            ( showFFloat )
+import qualified Data.Time.Clock as T
+import Platform.Runtime   ( unsafePerformIO )
+
+data PhaseTime = PhaseTime{ ptUnit  :: String   -- module or file
+                          , ptPhase :: String
+                          , ptWall  :: !Double   -- seconds
+                          , ptAlloc :: !Int64    -- bytes
+                          }
+
+data Timing = Timing{ tEnabled :: !Bool
+                    , tUnit    :: String        -- current unit for `timeMark`
+                    , tLast    :: (T.UTCTime,Int64)
+                    , tPhases  :: [PhaseTime]   -- in order of first occurrence
+                    }
+
+{-# NOINLINE vtiming #-}
+vtiming :: IORef Timing
+vtiming = unsafePerformIO $ newIORef (Timing False "" (zeroTime,0) [])
+  where
+    zeroTime = T.UTCTime (toEnum 0) 0
+
+timingEnable :: IO ()
+timingEnable
+  = modifyIORef vtiming (\t -> t{ tEnabled = True })
+
+timingEnabled :: IO Bool
+timingEnabled
+  = fmap tEnabled (readIORef vtiming)
+
+-- | Time an IO action (evaluating its result to weak head normal form).
+timeIO :: String -> String -> IO a -> IO a
+timeIO unit phase action
+  = do enabled <- timingEnabled
+       if (not enabled) then action
+        else do start <- now
+                x <- action >>= evaluate
+                end <- now
+                record unit phase start end
+                return x
+
+-- | Start timing the phases of `unit` with `timeMark`.
+timeStart :: String -> IO ()
+timeStart unit
+  = do enabled <- timingEnabled
+       if (not enabled) then return ()
+        else do time <- now
+                modifyIORef vtiming (\t -> t{ tUnit = unit, tLast = time })
+
+-- | Attribute the time since the previous mark to `phase`.
+timeMark :: String -> IO ()
+timeMark phase
+  = do t <- readIORef vtiming
+       if (not (tEnabled t)) then return ()
+        else do time <- now
+                record (tUnit t) phase (tLast t) time
+                modifyIORef vtiming (\tm -> tm{ tLast = time })
+
+-- | Place a mark from pure code: once `y` is demanded, `x` is evaluated
+-- (so the work of `phase` is done) and the mark is recorded.
+{-# NOINLINE timeMarkPure #-}
+timeMarkPure :: String -> a -> b -> b
+timeMarkPure phase x y
+  = unsafePerformIO (evaluate x >> timeMark phase) `seq` y
+
+now :: IO (T.UTCTime,Int64)
+now
+  = do time  <- T.getCurrentTime
+       alloc <- getAllocationCounter  -- counts down
+       return (time,alloc)
+
+record :: String -> String -> (T.UTCTime,Int64) -> (T.UTCTime,Int64) -> IO ()
+record unit phase (time0,alloc0) (time1,alloc1)
+  = modifyIORef vtiming (\t -> t{ tPhases = add (tPhases t) })
+  where
+    wall  = realToFrac (T.diffUTCTime time1 time0)
+    alloc = alloc0 - alloc1
+
+    add [] = [PhaseTime unit phase wall alloc]
+    add (pt:pts) | ptUnit pt == unit && ptPhase pt == phase
+                 = pt{ ptWall = ptWall pt + wall, ptAlloc = ptAlloc pt + alloc } : pts
+                 | otherwise
+                 = pt : add pts
+
+-- | Write the recorded phases as JSON to `fname`.
+timingWrite :: FilePath -> IO ()
+timingWrite fname
+  = do t <- readIORef vtiming
+       let phases = tPhases t
+           total  = sum (map ptWall phases)
+       writeFile fname $ unlines $
+         [ "{"
+         , "  \"total-ms\": " ++ ms total ++ ","
+         , "  \"phases\": ["
+         , intercalate ",\n" (map jsonPhase phases)
+         , "  ]"
+         , "}"
+         ]
+  where
+    jsonPhase (PhaseTime unit phase wall alloc)
+      = "    { \"unit\": " ++ jsonString unit ++ ", \"phase\": " ++ jsonString phase ++
+        ", \"wall-ms\": " ++ ms wall ++ ", \"alloc-bytes\": " ++ show alloc ++ " }"
+
+    ms secs = showFFloat (Just 3) (secs * 1000) ""
+
+    jsonString s = "\"" ++ concatMap escape s ++ "\""
+    escape c = case c of
+                 '"'  -> "\\\""
+                 '\\' -> "\\\\"
+                 '\n' -> "\\n"
+                 _    -> [c]
@@ -19,6 +19,9 @@ module Core.Borrowed( -- Borrowed parameter information
                     , extractBorrowDefs
                     , extractBorrowDef
                     , extractBorrowExternals
+
+                    , inferBorrowLocal
+                    , inferBorrowLoop
                     ) where
 
 import Lib.Trace
@@ -32,8 +35,9 @@ import qualified Common.NameMap as M
 import Common.Name
 import Common.ColorScheme
 import Core.Core
+import Type.Type
 import Type.Pretty
--- import qualified Core.CoreVar as CoreVar
+import qualified Core.CoreVar as CoreVar
 
 import Lib.Trace
 
@@ -104,6 +108,169 @@ extractBorrowDef isRec def
       DefFun pinfos | not (null pinfos) -> Just (defName def,pinfos)
       _ -> Nothing
 
+{--------------------------------------------------------------------------
+  Infer borrowing for local functions
+--------------------------------------------------------------------------}
+
+-- | Infer borrowing for the parameters of a local (non-recursive) function definition
+-- `def` that scopes over `scope`. We can only change the calling convention if we know
+-- all call sites, i.e. if the function is only directly applied in its scope (and thus
+-- never escapes, for example as an argument to `map`).
+-- A parameter is borrowed if the body only inspects it: it is only matched on, or only
+-- passed to borrowed parameters of other functions. This is always sound as the reference
+-- counting transformation adjusts to the borrow information; we just need to agree on it
+-- at the definition and at all call sites.
+-- Lambdas passed to higher-order functions like `map`, `foldl`, or `for` are out of scope:
+-- they are called through the generic closure calling convention which always passes
+-- owned arguments. They only benefit once specialization (at `-O1`) has inlined them
+-- into a specialized copy of the higher-order function.
+inferBorrowLocal :: Borrowed -> Def -> Expr -> Maybe BorrowDef
+inferBorrowLocal borrowed def scope
+  = case lamParams (defExpr def) of
+      Just (pars,body) | not (null pars) && onlyCalled (defName def) scope
+        -> let pinfos = map (inferParamInfo borrowed body) pars
+           in if (Borrow `elem` pinfos) then Just (defName def, pinfos) else Nothing
+      _ -> Nothing
+  where
+    lamParams expr
+      = case expr of
+          TypeLam _ body -> lamParams body
+          Lam pars _ body -> Just (pars,body)
+          _ -> Nothing
+
+-- | Infer borrowing for the loop invariant parameters of a self recursive function `def`:
+-- parameters that are passed unchanged in every recursive call and are otherwise only
+-- inspected. Returns the new parameter infos if any parameter can be borrowed. Since this
+-- changes the calling convention, the caller should only use it for a local worker
+-- where all call sites are known.
+inferBorrowLoop :: Borrowed -> Def -> Maybe [ParamInfo]
+inferBorrowLoop borrowed def
+  = case (defSort def, lamParams (defExpr def)) of
+      (DefFun pinfos, Just (pars,body)) | not (null calls) && onlyCalled (defName def) body
+        -> let pinfos0   = take (length pars) (pinfos ++ repeat Own)
+               invariant = [pinfo == Own && all (passedAt k par) calls | (k,par,pinfo) <- zip3 [0..] pars pinfos0]
+               -- assume all invariant parameters are borrowed in the recursive calls
+               borrowed1 = borrowedExtend (defName def, [if inv then Borrow else pinfo | (inv,pinfo) <- zip invariant pinfos0]) borrowed
+               pinfos1   = [if inv then inferParamInfo borrowed1 body par else pinfo | (inv,par,pinfo) <- zip3 invariant pars pinfos0]
+           in if (pinfos1 /= pinfos0) then Just pinfos1 else Nothing
+        where
+          calls = foldMapExpr recursiveCall body
+      _ -> Nothing
+  where
+    lamParams expr
+      = case expr of
+          TypeLam _ body -> lamParams body
+          Lam pars _ body -> Just (pars,body)
+          _ -> Nothing
+
+    recursiveCall expr
+      = case expr of
+          App (Var v _) args              | getName v == defName def -> [args]
+          App (TypeApp (Var v _) _) args  | getName v == defName def -> [args]
+          _ -> []
+
+    passedAt k par args
+      = case drop k args of
+          (Var v _ : _) -> v == par
+          _             -> False
+
+-- | A parameter is borrowed if all its uses only inspect it. We keep it owned though
+-- if the body allocates a constructor of the same type as the memory might be reused.
+inferParamInfo :: Borrowed -> Expr -> TName -> ParamInfo
+inferParamInfo borrowed body par
+  = if (onlyInspected borrowed (getName par) body && not (mayReuse (tnameType par) body))
+     then Borrow else Own
+
+-- | Is a (local) function only directly applied in an expression (and never rebound)?
+onlyCalled :: Name -> Expr -> Bool
+onlyCalled f expr
+  = case expr of
+      App (Var v _) args              | getName v == f -> all (onlyCalled f) args
+      App (TypeApp (Var v _) _) args  | getName v == f -> all (onlyCalled f) args
+      App fun args    -> onlyCalled f fun && all (onlyCalled f) args
+      Var v _         -> getName v /= f
+      Lam pars _ body -> notBound pars && onlyCalled f body
+      TypeLam _ body  -> onlyCalled f body
+      TypeApp body _  -> onlyCalled f body
+      Let dgs body    -> all onlyCalledDef (flattenDefGroups dgs) && onlyCalled f body
+      Case exprs brs  -> all (onlyCalled f) exprs && all onlyCalledBranch brs
+      _               -> True
+  where
+    notBound tnames
+      = all (\tname -> getName tname /= f) tnames
+    onlyCalledDef def
+      = defName def /= f && onlyCalled f (defExpr def)
+    onlyCalledBranch (Branch pats guards)
+      = notBound (concatMap patBinders pats) &&
+        all (\(Guard test body) -> onlyCalled f test && onlyCalled f body) guards
+
+-- | Is a variable `x` only inspected in an expression, i.e. only used as a match
+-- scrutinee or passed to a borrowed parameter?
+onlyInspected :: Borrowed -> Name -> Expr -> Bool
+onlyInspected borrowed x expr
+  = case expr of
+      Var v _         -> getName v /= x   -- any other use is in an owned position
+      App fun args    -> onlyInspected borrowed x fun && all inspectedArg (zip args (paramInfos fun ++ repeat Own))
+      Lam _ _ body    -> all (\tname -> getName tname /= x) (tnamesList (CoreVar.freeLocals body))  -- captured in a closure
+      TypeLam _ body  -> onlyInspected borrowed x body
+      TypeApp body _  -> onlyInspected borrowed x body
+      Let dgs body    -> all (onlyInspected borrowed x . defExpr) (flattenDefGroups dgs) && onlyInspected borrowed x body
+      Case exprs brs  -> all inspectedScrutinee exprs && all inspectedBranch brs
+      _               -> True
+  where
+    isX (Var v _) = (getName v == x)
+    isX _         = False
+
+    inspectedArg (arg,Borrow) | isX arg = True
+    inspectedArg (arg,_)      = onlyInspected borrowed x arg
+
+    inspectedScrutinee scrut
+      = isX scrut || onlyInspected borrowed x scrut
+
+    inspectedBranch (Branch _ guards)
+      = all (\(Guard test body) -> onlyInspected borrowed x test && onlyInspected borrowed x body) guards
+
+    paramInfos fun
+      = case fun of
+          Var v _             -> fromMaybe [] (borrowedLookup (getName v) borrowed)
+          TypeApp (Var v _) _ -> fromMaybe [] (borrowedLookup (getName v) borrowed)
+          _                   -> []
+
+-- | Does an expression allocate a constructor of the given type?
+mayReuse :: Type -> Expr -> Bool
+mayReuse tp body
+  = case dataTypeName tp of
+      Nothing    -> False
+      Just dname -> allocates dname body
+  where
+    allocates dname expr
+      = case expr of
+          App (Con _ repr) args@(_:_)              -> conTypeName repr == dname || any (allocates dname) args
+          App (TypeApp (Con _ repr) _) args@(_:_)  -> conTypeName repr == dname || any (allocates dname) args
+          App fun args    -> any (allocates dname) (fun:args)
+          Lam _ _ body    -> allocates dname body
+          TypeLam _ body  -> allocates dname body
+          TypeApp body _  -> allocates dname body
+          Let dgs body    -> any (allocates dname . defExpr) (flattenDefGroups dgs) || allocates dname body
+          Case exprs brs  -> any (allocates dname) exprs ||
+                             any (\(Guard test body) -> allocates dname test || allocates dname body) (concatMap branchGuards brs)
+          _               -> False
+
+    dataTypeName t
+      = case expandSyn t of
+          TApp t' _       -> dataTypeName t'
+          TForall _ _ t'  -> dataTypeName t'
+          TCon tcon       -> Just (typeConName tcon)
+          _               -> Nothing
+
+patBinders :: Pattern -> [TName]
+patBinders pat
+  = case pat of
+      PatCon{patConPatterns=pats} -> concatMap patBinders pats
+      PatVar tname pat'           -> tname : patBinders pat'
+      _                           -> []
+
+
 instance Show Borrowed where
  show = show . pretty
 
@@ -0,0 +1,310 @@
+-----------------------------------------------------------------------------
+-- Copyright 2021, Microsoft Research, Daan Leijen.
+--
+-- This is free software; you can redistribute it and/or modify it under the
+-- terms of the Apache License, Version 2.0. A copy of the License can be
+-- found in the LICENSE file at the root of this distribution.
+-----------------------------------------------------------------------------
+
+{-  Resolve operations statically if their handler is in the same function body.
+
+    After inlining, a local state handler looks like:
+
+      .handle-state(cfc, .Hnd-state(clause-tail-noyield0(fn(){ s }), ...), ret, fn(){
+        ... .perform0(.evv-at(0), .select-get) ...
+      })
+
+    In a direct position of the action, that is, not under a lambda that may be called
+    from somewhere else, the innermost `state` handler is always the one installed
+    here (nested handlers and masks for `state` take their action as a lambda and
+    are not entered). Such an operation can call the clause directly:
+
+      .perform0(.evv-at(0), .select-get)  ~>  (fn(){ s })()
+
+    and the simplifier then reduces it further. Direct positions include the bodies
+    of immediately applied lambdas (also through `.open` and `.mask-builtin`), the
+    actions of handlers for other effects, and the bodies of local functions that are
+    only ever called from direct positions (like a local loop).
+
+    We only resolve clauses that cannot yield (`clause-tail-noyield`) as those run
+    in the context of the operation anyway; other clauses still need the runtime
+    evidence. The handler itself is still installed for operations that are
+    performed elsewhere (for example by a top-level function called in the action).
+-}
+
+module Core.HandleResolve( handleResolve ) where
+
+import qualified Data.Set as S
+import Common.Name
+import Common.NamePrim( namePerform, nameEvvAt, nameMaskBuiltin, nameEffectOpen, nameClauseTailNoYield )
+import Type.Type
+import Kind.Newtypes( Newtypes, newtypesLookupAny )
+import Core.Core
+import Core.CoreVar( bv, freeLocals )
+import Core.Uniquefy( uniquefyExpr )
+
+data Env = Env{ newtypes :: Newtypes, inlineMax :: Int }
+
+-- | Resolve operations of handlers in the same function body.
+-- Only operation clauses with a cost up to `inlineMax` are copied.
+handleResolve :: Newtypes -> Int -> CorePhase ()
+handleResolve newtypes inlineMax
+  = liftCorePhase $ \defs -> map (resDefGroup (Env newtypes inlineMax)) defs
+
+resDefGroup :: Env -> DefGroup -> DefGroup
+resDefGroup env (DefRec defs)
+  = DefRec (map (resDef env) defs)
+resDefGroup env (DefNonRec def)
+  = DefNonRec (resDef env def)
+
+resDef :: Env -> Def -> Def
+resDef env def
+  = def{ defExpr = rewriteBottomUp (resHandle env) (defExpr def) }
+
+
+{--------------------------------------------------------------------------
+  Handlers
+--------------------------------------------------------------------------}
+
+-- | Resolve the operations in the action of a handler
+-- (inner handlers are already resolved as we go bottom up)
+resHandle :: Env -> Expr -> Expr
+resHandle env expr
+  = case expr of
+      App handle [cfc,hnd,ret,Lam [] eff body]
+        | isHandle handle, Just (dataName,clauses) <- handlerClauses env hnd, not (null clauses)
+        -> let bound = boundNames body
+               ops   = [(opName,op) | (opName,op) <- clauses, S.null (S.intersection (S.map getName (freeLocals op)) bound)]
+               direct = directFuns dataName body
+           in if null ops then expr
+               else App handle [cfc,hnd,ret,Lam [] eff (resAction dataName ops direct body)]
+      _ -> expr
+
+-- | Return the handler data type name and the resolvable clauses (indexed by operation name)
+handlerClauses :: Env -> Expr -> Maybe (Name,[(String,Expr)])
+handlerClauses env hnd
+  = case hnd of
+      App con clauses
+        | Just ctp <- conType con, Just dataName <- resultTypeName ctp,
+          Just dataInfo <- newtypesLookupAny dataName (newtypes env),
+          [conInfo] <- dataInfoConstrs dataInfo,
+          length (conInfoParams conInfo) == length clauses
+        -> Just (dataName, [(fieldOpName fname, op) | ((fname,_),clause) <- zip (conInfoParams conInfo) clauses
+                                                    , Just op <- [noYieldOp clause]])
+      _ -> Nothing
+  where
+    conType expr
+      = case expr of
+          Con cname _   -> Just (typeOf cname)
+          TypeApp e _   -> conType e
+          _             -> Nothing
+
+    -- fields are named by operation sort and name, like `fun-get`
+    fieldOpName fname
+      = drop 1 (dropWhile (/='-') (nameId fname))
+
+    noYieldOp clause
+      = case clause of
+          App c [op@(Lam pars _ _)]
+            | isVarNamed (nameClauseTailNoYield (length pars)) c && costExpr op <= inlineMax env -> Just op
+          _ -> Nothing
+
+-- | Return the handler data type name of a handler constructor application
+handlerDataName :: Expr -> Maybe Name
+handlerDataName hnd
+  = case hnd of
+      App con _     -> handlerDataName con
+      TypeApp e _   -> handlerDataName e
+      Con cname _   -> resultTypeName (typeOf cname)
+      _             -> Nothing
+
+
+{--------------------------------------------------------------------------
+  Actions
+--------------------------------------------------------------------------}
+
+-- | Resolve operations in direct positions of the action of a handler
+resAction :: Name -> [(String,Expr)] -> S.Set Name -> Expr -> Expr
+resAction dataName ops direct expr
+  = case expr of
+      -- an operation of this handler
+      App perform (ev:sel:args) | Just op <- performedOp dataName ops perform ev sel (length args)
+        -> App (uniquefyExpr op) (map res args)
+      -- the action of a handler for another effect
+      App handle [cfc,hnd,ret,Lam [] eff body] | isHandle handle && handlerDataName hnd /= Just dataName
+        -> App handle [cfc,hnd,ret,Lam [] eff (res body)]
+      -- immediately applied functions are evaluated in the same context
+      App (Lam pars eff body) args
+        -> App (Lam pars eff (res body)) (map res args)
+      App (App open [Lam pars eff body]) args | isVarNamed nameEffectOpen open
+        -> App (App open [Lam pars eff (res body)]) (map res args)
+      App mask [Lam [] eff body] | isVarNamed nameMaskBuiltin mask
+        -> App mask [Lam [] eff (res body)]
+      App f args      -> App (res f) (map res args)
+      TypeLam tvs e   -> TypeLam tvs (res e)
+      TypeApp e tps   -> TypeApp (res e) tps
+      Let dgs body    -> Let (map resDG dgs) (res body)
+      Case exprs brs  -> Case (map res exprs) (map resBranch brs)
+      _               -> expr  -- a lambda may be called from anywhere
+  where
+    res = resAction dataName ops direct
+
+    resDG (DefRec defs)   = DefRec (map resLocalDef defs)
+    resDG (DefNonRec def) = DefNonRec (resLocalDef def)
+
+    resLocalDef def
+      | defName def `S.member` direct = def{ defExpr = resFun (defExpr def) }
+      | isFunExpr (defExpr def)       = def
+      | otherwise                     = def{ defExpr = res (defExpr def) }
+
+    resFun fun
+      = case fun of
+          TypeLam tvs e     -> TypeLam tvs (resFun e)
+          Lam pars eff body -> Lam pars eff (res body)
+          _                 -> res fun
+
+    resBranch (Branch pats guards)
+      = Branch pats [Guard (res test) (res body) | Guard test body <- guards]
+
+-- | Is this `.perform(.evv-at(i), .select-op, args)` for an operation of the given handler?
+performedOp :: Name -> [(String,Expr)] -> Expr -> Expr -> Expr -> Int -> Maybe Expr
+performedOp dataName ops perform ev sel n
+  | isVarNamed (namePerform n) perform && isEvvAt ev
+  = case varOf sel of
+      Just (TName selName selTp) | isOpSelectorName selName && selectorDataName selTp == Just dataName
+        -> case lookup (nameId (fromOpSelectorName selName)) ops of
+             Just op@(Lam pars _ _) | length pars == n -> Just op
+             _ -> Nothing
+      _ -> Nothing
+  | otherwise
+  = Nothing
+  where
+    isEvvAt expr
+      = case expr of
+          App f [_] -> isVarNamed nameEvvAt f
+          _         -> False
+
+    -- the selector has type `hnd-eff<e,r> -> clause<..>`
+    selectorDataName tp
+      = case splitFunScheme tp of
+          Just (_,_,[(_,hndTp)],_,_) -> typeConName' hndTp
+          _ -> Nothing
+
+
+{--------------------------------------------------------------------------
+  Local functions that are only called from direct positions
+--------------------------------------------------------------------------}
+
+-- | Local functions in an action that are only called from direct positions.
+-- We start with all local functions and remove those that escape until we reach a fixpoint.
+directFuns :: Name -> Expr -> S.Set Name
+directFuns dataName body
+  = fixpoint (S.fromList (foldMapExpr localFuns body))
+  where
+    localFuns expr
+      = case expr of
+          Let dgs _ -> [defName def | def <- flattenDefGroups dgs, isFunExpr (defExpr def)]
+          _         -> []
+
+    fixpoint funs
+      = let funs' = S.filter (\f -> not (escapes dataName funs f body)) funs
+        in if (S.size funs' == S.size funs) then funs else fixpoint funs'
+
+-- | Is a local function `f` used other than called in a direct position?
+-- The bodies of the functions in `direct` count as direct positions.
+escapes :: Name -> S.Set Name -> Name -> Expr -> Bool
+escapes dataName direct f expr
+  = case expr of
+      Var v _         -> getName v == f
+      App handle [cfc,hnd,ret,Lam [] _ body] | isHandle handle && handlerDataName hnd /= Just dataName
+                      -> any esc [cfc,hnd,ret] || esc body
+      App mask [Lam [] _ body] | isVarNamed nameMaskBuiltin mask
+                      -> esc body
+      App fun args    -> escCall fun || any esc args
+      Lam _ _ body    -> occurs body
+      TypeLam _ e     -> esc e
+      TypeApp e _     -> esc e
+      Let dgs body    -> any escDef (flattenDefGroups dgs) || esc body
+      Case exprs brs  -> any esc exprs || any (\(Guard test body) -> esc test || esc body) (concatMap branchGuards brs)
+      _               -> False
+  where
+    esc = escapes dataName direct f
+
+    occurs e
+      = any (\tname -> getName tname == f) (tnamesList (freeLocals e))
+
+    escCall fun
+      = case fun of
+          _ | isVarNamed f fun -> False
+          App open [g] | isVarNamed nameEffectOpen open -> escCall g
+          Lam _ _ body -> esc body
+          _            -> esc fun
+
+    escDef def
+      | defName def `S.member` direct = escFun (defExpr def)
+      | isFunExpr (defExpr def)       = occurs (defExpr def)
+      | otherwise                     = esc (defExpr def)
+
+    escFun fun
+      = case fun of
+          TypeLam _ e     -> escFun e
+          Lam _ _ body    -> esc body
+          _               -> esc fun
+
+
+{--------------------------------------------------------------------------
+  Helpers
+--------------------------------------------------------------------------}
+
+-- | All names bound in an expression
+boundNames :: Expr -> S.Set Name
+boundNames body
+  = foldMapExpr binders body
+  where
+    binders expr
+      = case expr of
+          Lam pars _ _  -> S.fromList (map getName pars)
+          Let dgs _     -> S.map getName (bv dgs)
+          Case _ brs    -> S.map getName (bv (concatMap branchPatterns brs))
+          _             -> S.empty
+
+isHandle :: Expr -> Bool
+isHandle expr
+  = case varOf expr of
+      Just tname -> isHandleName (getName tname)
+      Nothing    -> False
+
+isVarNamed :: Name -> Expr -> Bool
+isVarNamed name expr
+  = case varOf expr of
+      Just tname -> getName tname == name
+      Nothing    -> False
+
+varOf :: Expr -> Maybe TName
+varOf expr
+  = case expr of
+      Var tname _   -> Just tname
+      TypeApp e _   -> varOf e
+      _             -> Nothing
+
+isFunExpr :: Expr -> Bool
+isFunExpr expr
+  = case expr of
+      TypeLam _ e   -> isFunExpr e
+      Lam _ _ _     -> True
+      _             -> False
+
+-- | The result type constructor name of a (constructor) function type
+resultTypeName :: Type -> Maybe Name
+resultTypeName tp
+  = case splitFunScheme tp of
+      Just (_,_,_,_,res) -> typeConName' res
+      Nothing            -> Nothing
+
+typeConName' :: Type -> Maybe Name
+typeConName' tp
+  = case expandSyn tp of
+      TApp t _        -> typeConName' t
+      TForall _ _ t   -> typeConName' t
+      TCon tcon       -> Just (typeConName tcon)
+      _               -> Nothing
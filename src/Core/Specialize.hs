@@ -65,6 +65,14 @@ import Lib.Trace
       Nil -> Nil
       Cons(x, xx) -> Cons(inc(x), xx.spec_map())
   spec_map(list(1, 10))
+
+  We also specialize calls that instantiate an effect polymorphic function with an
+  effect that never yields (like `<console,div>` or only tail-resumptive operations),
+  even if no argument is known. Since the specialized definition is monomorphic,
+  the monadic translation no longer inserts yield checks and continuations in it.
+  This is only done for closed type arguments: the specialization is a new top-level
+  definition that is created once for each function and type arguments, and is shared
+  by all call sites in the module. Only functions up to `yieldFreeMaxCost` are copied.
 -}
 
 {--------------------------------------------------------------------------
@@ -75,13 +83,24 @@ data ReadState = ReadState
   { inlines :: Inlines
   , penv    :: Env
   }
-type SpecM = UniqueT (Reader ReadState)
+
+data SpecState = SpecState
+  { specCache   :: [((Name,[Type]),TName)]  -- yield-free specializations by function and type arguments
+  , specEmitted :: [DefGroup]               -- new top-level specializations (in reverse)
+  }
+
+type SpecM = UniqueT (ReaderT ReadState (State SpecState))
 
 runSpecM :: Int -> ReadState -> SpecM a -> (a, Int)
 runSpecM uniq readState specM =
-    flip runReader readState
+    flip evalState (SpecState [] [])
+  $ flip runReaderT readState
   $ runUniqueT uniq specM
 
+-- maximal size of a function that is copied for a yield-free instantiation
+yieldFreeMaxCost :: Int
+yieldFreeMaxCost = 40
+
 
 {--------------------------------------------------------------------------
   Specialization
@@ -92,15 +111,19 @@ specialize specEnv penv
   = liftCorePhaseUniq  $ \uniq defs ->
     -- TODO: use uniqe int to generate names and remove call to uniquefyDefGroups?
     let (defs', u') = runSpecM (uniq+100) (ReadState specEnv penv) (mapM specOneDefGroup defs)
-    in (uniquefyDefGroups defs', u')
+    in (uniquefyDefGroups (concat defs'), u')
 
 speclookup :: Name -> SpecM (Maybe InlineDef)
 speclookup name
   = lift $ asks (\ReadState{inlines=inlines} ->
       filterMaybe inlineDefIsSpecialize (inlinesLookup name inlines))
 
-specOneDefGroup :: DefGroup -> SpecM DefGroup
-specOneDefGroup = mapMDefGroup specOneDef
+-- new top-level specializations are placed before the definition group that first uses them
+specOneDefGroup :: DefGroup -> SpecM [DefGroup]
+specOneDefGroup dg
+  = do dg' <- mapMDefGroup specOneDef dg
+       emitted <- lift $ state (\st -> (specEmitted st, st{ specEmitted = [] }))
+       return (reverse emitted ++ [dg'])
 
 specOneDef :: Def -> SpecM Def
 specOneDef def
@@ -126,7 +149,7 @@ specOneExpr thisDefName
               Nothing -> pure e
               Just specDef
                 | inlineName specDef /= thisDefName -> -- trace ("specialize " <> show (inlineName specDef) <> " in " <> show thisDefName) $
-                                                       specOneCall specDef e   -- don't specialize ourselves
+                                                       specOneCall thisDefName specDef e   -- don't specialize ourselves
                 | otherwise -> pure e
 
 filterBools :: [Bool] -> [a] -> [a]
@@ -141,8 +164,8 @@ partitionBools bools as = foldr f ([], []) $ zip bools as
       | bool = (falses, a : trues)
       | otherwise = (a : falses, trues)
 
-specOneCall :: InlineDef -> Expr -> SpecM Expr
-specOneCall inlineDef@(InlineDef{ inlineName=specName, inlineExpr=specExpr, inlineParamSpecialize=specArgs, inlineSort=sort }) e
+specOneCall :: Name -> InlineDef -> Expr -> SpecM Expr
+specOneCall thisDefName inlineDef@(InlineDef{ inlineName=specName, inlineExpr=specExpr, inlineParamSpecialize=specArgs, inlineSort=sort }) e
   = case e of
       App (Var (TName name _) _) args
        | gArgs <- goodArgs specArgs args
@@ -152,10 +175,39 @@ specOneCall inlineDef@(InlineDef{ inlineName=specName, inlineExpr=specExpr, inli
        | gArgs <- goodArgs specArgs args
        , any isJust gArgs
         -> replaceCall specName specExpr sort specArgs (newArgs gArgs args) $ Just typeArgs
+      App (TypeApp (Var (TName name ty) _) typeArgs) args
+       | isYieldFree ty typeArgs && tvsIsEmpty (ftv typeArgs) && costExpr specExpr <= yieldFreeMaxCost
+        -> specYieldFree thisDefName inlineDef typeArgs args
       _ -> return e
 
   where newArgs gArgs args = zipWith fromMaybe args gArgs
 
+        -- an effect polymorphic function instantiated with an effect that never yields:
+        -- the monomorphic copy needs no yield checks after the monadic translation
+        isYieldFree ty typeArgs
+          = isMonType ty && not (isMonType (typeOf (TypeApp (Var (TName specName ty) InfoNone) typeArgs)))
+
+-- Specialize an instantiation with closed type arguments and an effect that never yields.
+-- The specialization is a new top-level definition `.spec<n>-<f>` (named after the
+-- specialized function `f`) that is reused by all later calls with the same type arguments.
+specYieldFree :: Name -> InlineDef -> [Type] -> [Expr] -> SpecM Expr
+specYieldFree thisDefName InlineDef{ inlineName=name, inlineExpr=expr, inlineParamSpecialize=specArgs, inlineSort=sort } typeArgs args
+  = do cache <- lift $ gets specCache
+       case lookup (name,typeArgs) cache of
+         Just tname -> return (callTo tname)
+         Nothing
+          -> do i <- unique
+                let topName = toHiddenUniqueName i "spec" (qualify (qualifier thisDefName) (unqualify name))
+                (specDef,_) <- specializeDef topName name expr sort noSpecArgs args (Just typeArgs)
+                lift $ modify (\st -> st{ specCache = ((name,typeArgs),defTName specDef) : specCache st })
+                -- specialize the calls in the new definition as well; the cache ensures termination
+                body <- specOneExpr topName (defExpr specDef)
+                lift $ modify (\st -> st{ specEmitted = DefRec [specDef{ defExpr = body }] : specEmitted st })
+                return (callTo (defTName specDef))
+  where
+    noSpecArgs   = map (const False) specArgs
+    callTo tname = App (Var tname (InfoArity 0 (length args))) args
+
 -- specOneCall :: InlineDef -> Expr -> SpecM Expr
 -- specOneCall inlineDef@(InlineDef{ inlineName=specName, inlineExpr=specExpr, inlineParamSpecialize=specArgs }) e
 --   = case e of
@@ -302,6 +354,13 @@ comment = unlines . map ("// " ++) . lines
 -- since the type of the body depends on the type of the functions that it calls and vice versa
 replaceCall :: Name -> Expr -> DefSort -> [Bool] -> [Expr] -> Maybe [Type] -> SpecM Expr
 replaceCall name expr sort bools args mybeTypeArgs 
+  = do specName <- uniqueName "spec"
+       (specDef,newArgs) <- specializeDef specName name expr sort bools args mybeTypeArgs
+       return $ Let [DefRec [specDef]] (App (Var (defTName specDef) InfoNone) newArgs)
+
+-- Create a specialized definition `specName` of function `name` and return it with the remaining arguments
+specializeDef :: Name -> Name -> Expr -> DefSort -> [Bool] -> [Expr] -> Maybe [Type] -> SpecM (Def,[Expr])
+specializeDef specName name expr sort bools args mybeTypeArgs 
   = do
       -- extract the specialized parameters
       let ((newParams, newArgs), (speccedParams, speccedArgs)) 
@@ -321,7 +380,6 @@ replaceCall name expr sort bools args mybeTypeArgs
               $ fnBody expr
       
       -- substitute self-recursive calls to call our new specialized definition (without the specialized arguments!)
-      specName <- uniqueName "spec"
       let specType  = typeOf specBody0
           specTName = TName specName specType
           specBody  = case specBody0 of
@@ -339,7 +397,7 @@ replaceCall name expr sort bools args mybeTypeArgs
                      $ "// specialized: " <> show name <> ", on parameters " <> concat (intersperse ", " (map show speccedParams)) <> ", using:\n" <>
                        comment (unlines [show param <> " = " <> show arg | (param,arg) <- zip speccedParams speccedArgs])
       
-      return $ Let [DefRec [specDef]] (App (Var (defTName specDef) InfoNone) newArgs)
+      return (specDef,newArgs)
 
 fnTypeParams :: Expr -> [TypeVar]
 fnTypeParams (TypeLam typeParams _) = typeParams
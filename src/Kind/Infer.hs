@@ -93,7 +93,7 @@ inferKinds
 inferKinds isValue colors platform mbRangeMap imports kgamma0 syns0 data0 
             (Program source modName nameRange tdgroups defs importdefs externals fixdefs doc)
   =do unique0 <- unique
-      let (errs1,warns1,rm1,unique1,(cgroups,kgamma1,syns1,data1)) = runKindInfer colors platform mbRangeMap modName imports kgamma0 syns0 data0 unique0 (infTypeDefGroups tdgroups)
+      let (errs1,warns1,rm1,unique1,(cgroups,kgamma1,syns1,data1)) = runKindInfer colors platform mbRangeMap modName imports kgamma0 syns0 data0 unique0 (infTypeDefGroups (fieldTypeNames tdgroups) tdgroups)
           (errs2,warns2,rm2,unique2,externals1)              = runKindInfer colors platform rm1 modName imports kgamma1 syns1 data1 unique1 (infExternals externals)
           (errs3,warns3,rm3,unique3,defs1)                   = runKindInfer colors platform rm2 modName imports kgamma1 syns1 data1 unique2 (infDefGroups defs)
   --        (errs4,warns4,unique4,cgroups)                 = runKindInfer colors modName imports kgamma1 syns1 unique3 (infCoreTDGroups cgroups)
@@ -304,36 +304,56 @@ constructorCheckDuplicates cscheme conInfos
 {---------------------------------------------------------------
   Infer kinds for type definition groups
 ---------------------------------------------------------------}
-infTypeDefGroups :: [TypeDefGroup UserType UserKind] -> KInfer ([Core.TypeDefGroup],KGamma,Synonyms,Newtypes)
-infTypeDefGroups (tdgroup:tdgroups)
-  = do (ctdgroup)  <- infTypeDefGroup tdgroup
-       (ctdgroups,kgamma,syns,datas) <- extendKGamma (getRanges tdgroup) ctdgroup $ infTypeDefGroups tdgroups
+infTypeDefGroups :: [Name] -> [TypeDefGroup UserType UserKind] -> KInfer ([Core.TypeDefGroup],KGamma,Synonyms,Newtypes)
+infTypeDefGroups fieldNames (tdgroup:tdgroups)
+  = do (ctdgroup)  <- infTypeDefGroup fieldNames tdgroup
+       (ctdgroups,kgamma,syns,datas) <- extendKGamma (getRanges tdgroup) ctdgroup $ infTypeDefGroups fieldNames tdgroups
        return (ctdgroup:ctdgroups,kgamma,syns,datas)
   where
     getRanges (TypeDefRec tdefs)   = map getRange tdefs
     getRanges (TypeDefNonRec tdef) = [getRange tdef]
 
-infTypeDefGroups []
+infTypeDefGroups fieldNames []
   = do kgamma <- getKGamma
        syns <- getSynonyms
        datas <- getAllNewtypes
        return ([],kgamma,syns,datas)
 
-infTypeDefGroup :: TypeDefGroup UserType UserKind -> KInfer (Core.TypeDefGroup)
-infTypeDefGroup (TypeDefRec tdefs)
-  = infTypeDefs True tdefs
+-- | The names of the types that are used directly as a constructor field of another type
+-- in this module (and may thus be flattened into that constructor if they are value types).
+fieldTypeNames :: [TypeDefGroup UserType UserKind] -> [Name]
+fieldTypeNames tdgroups
+  = [unqualify name | tdgroup <- tdgroups, tdef@(DataType{}) <- typeDefs tdgroup
+                    , con <- typeDefConstrs tdef, (_,par) <- userconParams con
+                    , name <- tpConNames (binderType par)
+                    , unqualify name /= unqualify (tbinderName (typeDefBinder tdef))]
+  where
+    typeDefs (TypeDefRec tdefs)   = tdefs
+    typeDefs (TypeDefNonRec tdef) = [tdef]
+
+    tpConNames tp
+      = case tp of
+          TpCon name _  -> [name]
+          TpApp tp _ _  -> tpConNames tp   -- only the outer type is stored inline
+          TpParens tp _ -> tpConNames tp
+          TpAnn tp _    -> tpConNames tp
+          _             -> []
 
-infTypeDefGroup (TypeDefNonRec tdef)
-  = infTypeDefs False [tdef]
+infTypeDefGroup :: [Name] -> TypeDefGroup UserType UserKind -> KInfer (Core.TypeDefGroup)
+infTypeDefGroup fieldNames (TypeDefRec tdefs)
+  = infTypeDefs fieldNames True tdefs
 
-infTypeDefs isRec tdefs
+infTypeDefGroup fieldNames (TypeDefNonRec tdef)
+  = infTypeDefs fieldNames False [tdef]
+
+infTypeDefs fieldNames isRec tdefs
   = do -- trace ("infTypeDefs: " ++ show (length tdefs)) $ return ()
        xinfgamma <- mapM bindTypeDef tdefs -- set up recursion
        let infgamma = map fst (filter snd xinfgamma)
        ctdefs   <- extendInfGamma infgamma $ -- extend inference gamma, also checks for duplicates
                    do let names = map tbinderName infgamma
                       tdefs1 <- mapM infTypeDef (zip (map fst xinfgamma) tdefs)
-                      mapM (resolveTypeDef isRec names) tdefs1
+                      mapM (resolveTypeDef fieldNames isRec names) tdefs1
        checkRecursion tdefs -- check for recursive type synonym definitions rather late so we spot duplicate definitions first
        return (Core.TypeDefGroup ctdefs)
 
@@ -764,8 +784,8 @@ checkExtendLabel r= Check "The elements of an effect must be effect constants" r
 {---------------------------------------------------------------
   Resolve kinds: from InfKind to Kind, and UserType to Type
 ---------------------------------------------------------------}
-resolveTypeDef :: Bool -> [Name] -> TypeDef (KUserType InfKind) UserType InfKind -> KInfer (Core.TypeDef)
-resolveTypeDef isRec recNames (Synonym syn params tp range vis doc)
+resolveTypeDef :: [Name] -> Bool -> [Name] -> TypeDef (KUserType InfKind) UserType InfKind -> KInfer (Core.TypeDef)
+resolveTypeDef fieldNames isRec recNames (Synonym syn params tp range vis doc)
   = do syn' <- resolveTypeBinderDef syn
        params' <- mapM resolveTypeBinder params
        typeVars  <- mapM (\param -> freshTypeVar param Bound) params'
@@ -790,7 +810,7 @@ resolveTypeDef isRec recNames (Synonym syn params tp range vis doc)
     kindArity (KApp (KApp kcon k1) k2)  | kcon == kindArrow = k1 : kindArity k2
     kindArity _ = []
 
-resolveTypeDef isRec recNames (DataType newtp params constructors range vis sort ddef isExtend doc)
+resolveTypeDef fieldNames isRec recNames (DataType newtp params constructors range vis sort ddef isExtend doc)
   = do -- trace ("datatype: " ++ show(tbinderName newtp) ++ " " ++ show isExtend) $ return ()
        newtp' <- if isExtend
                   then do (qname,ikind) <- findInfKind (tbinderName newtp) (tbinderRange newtp)
@@ -858,7 +878,7 @@ resolveTypeDef isRec recNames (DataType newtp params constructors range vis sort
                               -> do addError range (text "Type" <+> nameDoc <+> text "cannot be used as a value type.")  -- should never happen?
                                     return DataDefNormal
                             (DataDefAuto, DataDefValue m n)
-                              -> if ((m + (n*sizePtr platform)) <= 3*(sizePtr platform)
+                              -> if ((m + (n*sizeField platform)) <= autoValueMaxWords isField infos m n * (sizePtr platform)
                                       && hasKindStarResult (getKind typeResult)
                                       && (sort /= Retractive))
                                   then -- trace ("default to value: " ++ show name ++ ": " ++ show (m,n)) $
@@ -874,6 +894,18 @@ resolveTypeDef isRec recNames (DataType newtp params constructors range vis sort
   where
     conVis (UserCon name exist params result rngName rng vis _) = vis
 
+    -- Is this type stored directly as a field of a constructor of another type in this module?
+    isField = unqualify (tbinderName newtp) `elem` fieldNames
+
+    -- The maximal size (in machine words) of a non-recursive type to be a value type by default.
+    -- Structs (with a single constructor) that are stored in a parent constructor are flattened
+    -- into it, so we allow them to be a bit larger as long as they do not mix raw and regular fields
+    -- (as a constructor can contain only one such mixed value type field). Other types keep the
+    -- usual limit as a larger value type is more expensive to pass and return.
+    autoValueMaxWords :: Bool -> [ConInfo] -> Int -> Int -> Int
+    autoValueMaxWords True [_] m n | m == 0 || n == 0  = 4
+    autoValueMaxWords _ _ _ _                          = 3
+
     toDefValues :: Platform -> Bool -> Name -> Doc -> [ConInfo] -> KInfer DataDef
     toDefValues platform isVal qname nameDoc conInfos
       = do ddefs <- mapM (toDefValue nameDoc) conInfos
@@ -905,7 +937,9 @@ resolveTypeDef isRec recNames (DataType newtp params constructors range vis sort
                         then 1
                        else if (name == nameTpInt16 || name == nameTpFloat16)
                         then 2
-                       else if (name == nameTpAny || name == nameTpCField || name == nameTpIntPtrT)
+                       else if (name == nameTpAny)
+                        then (sizeField platform)
+                       else if (name == nameTpCField || name == nameTpIntPtrT)
                         then (sizePtr platform)
                        else if (name==nameTpSSizeT)
                         then (sizeSize platform)
@@ -12,18 +12,23 @@
 module Main where
 
 import System.Exit            ( exitFailure )
-import Control.Monad          ( when )
+import System.IO              ( stdin, stdout, hWaitForInput, hFlush, isEOF )
+import System.Directory       ( doesFileExist )
+import Control.Monad          ( when, foldM )
+import Data.List              ( nub )
 
 import Platform.Config
-import Lib.PPrint             ( Pretty(pretty), writePrettyLn )
+import Lib.PPrint             ( Pretty(pretty), writePrettyLn, text )
 import Lib.Printer
 import Common.ColorScheme
 import Common.Failure         ( catchIO )
 import Common.Error
 import Common.Name
-import Common.File            ( joinPath )
+import Common.File            ( joinPath, getFileTime, fileTime0 )
 import Compiler.Options
 import Compiler.Compile       ( compileFile, CompileTarget(..), Module(..), Loaded(..), Terminal(..) )
+import Compiler.Module        ( Modules, removeModulesWithDependents )
+import Compiler.Timing        ( timingEnable, timingWrite )
 import Core.Core              ( coreProgDefs, flattenDefGroups, defType, Def(..) )
 import Interpreter.Interpret  ( interpret  )
 import Kind.ImportMap         ( importsEmpty )
@@ -75,23 +80,30 @@ mainMode flags flags0 mode p
      ModeVersion
       -> withNoColorPrinter (\monop -> showVersion flags monop)
      ModeCompiler files
-      -> mapM_ (compile p flags) files
+      -> do when (not (null (timePasses flags))) timingEnable
+            if (watch flags)
+             then watchFiles p flags files
+             else mapM_ (compile p flags []) files
+            when (not (null (timePasses flags))) $
+              timingWrite (timePasses flags)
      ModeInteractive files
       -> interpret p flags flags0 files
 
 
-compile :: ColorPrinter -> Flags -> FilePath -> IO ()
-compile p flags fname
+-- | Compile a file reusing the already compiled `modules`; returns the modules loaded afterwards.
+compile :: ColorPrinter -> Flags -> Modules -> FilePath -> IO Modules
+compile p flags modules fname
   = do let exec = Executable (newName "main") ()
-       err <- compileFile term flags []
+       err <- compileFile term flags modules
                 (if (not (evaluate flags)) then (if library flags then Library else exec) else exec) fname
        case checkError err of
          Left msg
            -> do putPrettyLn p (ppErrorMessage (showSpan flags) cscheme msg)
                  -- exitFailure  -- don't fail for tests
+                 return modules
 
-         Right (Loaded gamma kgamma synonyms newtypes constructors _ imports _ 
-                (Module modName _ _ _ _ _warnings rawProgram core _ _ modTime) _ _ _
+         Right (loaded@(Loaded gamma kgamma synonyms newtypes constructors _ imports _ 
+                (Module modName _ _ _ _ _warnings rawProgram core _ _ modTime) _ _ _)
                , warnings)
            -> do when (not (null warnings))
                    (let msg = ErrorWarning warnings ErrorZero
@@ -108,6 +120,7 @@ compile p flags fname
                  else if showTypeSigs flags then
                    putPrettyLn p $ ppGamma (prettyEnv flags modName imports) $ gammaFilter modName gamma
                  else pure ()
+                 return (loadedModules loaded)
   where
     term
       = Terminal (putErrorMessage p (showSpan flags) cscheme)
@@ -123,6 +136,78 @@ compile p flags fname
     prettyEnv flags ctx imports
       = (prettyEnvFromFlags flags){ context = ctx, importsMap = imports }
 
+
+{---------------------------------------------------------------
+  Watch mode: the compiler keeps running with all compiled modules
+  in memory. Every `watchInterval` milliseconds the sources of the
+  loaded modules are checked, and the changed modules and their
+  dependents are recompiled (reusing all other modules).
+  Each line on `stdin` is a build request from a client: a file
+  to compile (and watch), an empty line to rebuild, or `:q` to quit.
+  After each build `watchDone` is written to `stdout`.
+---------------------------------------------------------------}
+
+watchFiles :: ColorPrinter -> Flags -> [FilePath] -> IO ()
+watchFiles p flags files0
+  = do (modules,times) <- build files0 [] []
+       loop files0 modules times
+  where
+    loop files modules times
+      = do hasInput <- hWaitForInput stdin watchInterval `catchIO` (\_ -> return False)
+           if (not hasInput)
+            then do changed <- changedSources times
+                    if (null changed)
+                     then loop files modules times
+                     else rebuild files modules times changed
+            else do eof <- isEOF
+                    if eof then return ()
+                     else do request <- getLine
+                             serve files modules times (words request)
+
+    serve files modules times request
+      = case request of
+          [":q"]  -> return ()
+          []      -> do changed <- changedSources times
+                        rebuild files modules times changed
+          [fname] -> do let files' = if fname `elem` files then files else files ++ [fname]
+                        (modules',times') <- build [fname] modules times
+                        loop files' modules' times'
+          _       -> do putPrettyLn p (text ("error: invalid request: " ++ unwords request))
+                        loop files modules times
+
+    rebuild files modules times changed
+      = do let names = [modName mod | mod <- modules, modSourcePath mod `elem` changed]
+           (modules',times') <- build files (removeModulesWithDependents names modules) times
+           loop files modules' times'
+
+    -- compile and remember the modification times of all sources seen so far
+    -- (including those of modules that failed to compile)
+    build files modules times
+      = do modules' <- foldM (compile p flags) modules files
+           let sources = nub (map fst times ++ files ++
+                              [modSourcePath mod | mod <- modules', not (null (modSourcePath mod))])
+           times' <- mapM (\fname -> do ftime <- sourceTime fname
+                                        return (fname,ftime)) sources
+           writeLn p watchDone
+           hFlush stdout
+           return (modules',times')
+
+    changedSources times
+      = do current <- mapM (sourceTime . fst) times
+           return [fname | ((fname,ftime),ctime) <- zip times current, ftime /= ctime]
+
+    sourceTime fname
+      = do exist <- doesFileExist fname
+           if exist then getFileTime fname else return fileTime0
+
+-- | Polling interval in milliseconds
+watchInterval :: Int
+watchInterval = 250
+
+-- | Written to `stdout` after each build in watch mode
+watchDone :: String
+watchDone = "-- watch: done"
+
 gammaFromDefGroups groups = gammaNew $ map defToGammaEntry $ flattenDefGroups groups
   where
     defToGammaEntry def = (defName def, createNameInfoX (defVis def) (defName def)  (defSort def) (defNameRange def) (defType def))
@@ -149,12 +149,18 @@ combineLineComments lexs
     scan lexs
       = case lexs of
           -- combine newline comments into one big comment. This is for html output.
-          (Lexeme r1 (LexComment ('/':'/':c1)) : Lexeme r2 (LexComment ('/':'/':c2)) : ls)
-              -> scan (Lexeme (combineRange r1 r2) (LexComment ("//" ++ c1 ++ "//" ++ c2)) : ls)
+          (Lexeme r1 (LexComment ('/':'/':c1)) : ls@(Lexeme _ (LexComment ('/':'/':_)) : _))
+              -> let (rng,cs,rest) = collect r1 [c1] ls  -- collect all at once to avoid quadratic appends
+                 in Lexeme rng (LexComment (concatMap ("//" ++) cs)) : scan rest
           (l:ls)
               -> l : scan ls
           []  -> []
 
+    collect rng acc lexs
+      = case lexs of
+          (Lexeme r (LexComment ('/':'/':c)) : ls) -> collect (combineRange rng r) (c:acc) ls
+          _                                        -> (rng, reverse acc, lexs)
+
 -----------------------------------------------------------
 -- Check for comments in indentation
 -----------------------------------------------------------
@@ -396,7 +396,6 @@ data State = State { pos      :: !Pos    -- current position
                    , startPos :: !Pos    -- token start position (for 'more')
                    , states   :: ![Int]
                    , retained :: ![BString]
-                   , previous :: !Char
                    , current  :: !BString
                    , previousLex :: Lex
                    , rawEnd   :: String  
@@ -463,23 +462,23 @@ constant x
 
 ------------------------------------------------------------------------------
 -- Set up the Alex lexer framework
+-- The scanner only consumes the remaining input so we do not allocate
+-- a new `State` for every byte; the state is updated once per token.
 ------------------------------------------------------------------------------
-type AlexInput = State
+type AlexInput = BString
 type Byte   = Word8
 
 alexInputPrevChar :: AlexInput -> Char
-alexInputPrevChar st = previous st
+alexInputPrevChar _ = '\n'
 
 alexGetByte :: AlexInput -> Maybe (Byte,AlexInput)
-alexGetByte st@State{ current = cs }
-  = if B.null cs then Nothing
-    else Just (B.head cs, st{ current = B.tail cs })
+alexGetByte cs
+  = B.uncons cs
 
 -- compatibility
 alexGetChar :: AlexInput -> Maybe (Char,AlexInput)
-alexGetChar st@State{ current = cs }
-  = if BC.null cs then Nothing
-    else Just (BC.head cs, st{ current = BC.tail cs })
+alexGetChar cs
+  = BC.uncons cs
 
 
 -- alexScanTokens :: ByteString -> [token]
@@ -490,23 +489,24 @@ lexer sourceName lineNo input
 lexing :: Source -> Int -> BString -> [Lexeme]
 lexing source lineNo input
   = let initPos = makePos source 0 lineNo 1
-        initSt  = State initPos initPos [0] [] '\n' input (LexWhite "") "\""
+        initSt  = State initPos initPos [0] [] input (LexWhite "") "\""
     in go initSt
   where go st =
           -- trace ("scan: start: " ++ show (startPos st) ++ ", " ++ show (pos st) ++ ": <" ++ show (head (states st)) ++ ">: " ++ show (BC.take 5 (current st))) $
           let idx0 = B.length (current st) in
-          case alexScan st (head (states st)) of
+          case alexScan (current st) (head (states st)) of
             AlexEOF -> []
-            AlexSkip  st1 len
+            AlexSkip  _ len
               -> failure "Syntax.Lexer: rule without action"
-            AlexError st1
-              -> let range = makeRange (pos st) (pos st1) in
+            AlexError input1
+              -> let range = makeRange (pos st) (pos st) in
                  if B.null (current st)
                   then [Lexeme range $ LexError "unexpected end of input"]
                   else Lexeme range (LexError ("unexpected character " ++ show (BC.head (current st))))
-                        : go (st1{ current = B.tail (current st1) })
-            AlexToken st1 len act  -- len is wrong with utf8!
-              -> let idx1 = B.length (current st1)
+                        : go (st{ current = B.tail input1 })
+            AlexToken input1 len act  -- len is wrong with utf8!
+              -> let st1  = st{ current = input1 }
+                     idx1 = B.length input1
                      bs = B.take (idx0 - idx1) (current st)
                      p  = posMoves8 (pos st) bs
                      (mbtoken,st2) = seq p $ act bs st st1{ pos = p }